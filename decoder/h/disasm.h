@@ -0,0 +1,16 @@
+/* File: disasm.h */
+/* Disassembly of single instructions. */
+
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Function disassemble writes the instruction with first word ir0 and second word ir1
+ * (ignored unless is_long is set) to buf in assembly language, as the assembler would
+ * read it, with mnemonics from the instruction table of the assembler. The RET and HALT
+ * pseudoinstructions are recognized by their encoding. */
+void disassemble(uint16_t ir0, uint16_t ir1, int is_long, char *buf, size_t size);
+
+#endif /* DISASM_H */
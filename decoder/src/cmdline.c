@@ -0,0 +1,96 @@
+/* File: cmdline.c */
+/* Command line arguments parsing. */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Note: non-standard header, available on GNU systems */
+#include <getopt.h>
+
+#include "cmdline.h"
+
+extern char *trace_filename;
+extern char *out_filename;
+extern uint64_t last_records;
+
+static void parse_last_records(const char *arg)
+{
+    char *end;
+    unsigned long long n = strtoull(arg, &end, 10);
+    if (!isdigit((unsigned char) *arg) || *end != '\0' || n == 0)
+    {
+        fprintf(stderr, "Invalid number of records '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    last_records = n;
+}
+
+void parse_cmdline(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int c;
+
+    opterr = 0;
+
+    while ((c = getopt_long(argc, argv, "o:n:h", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'o':
+            out_filename = optarg;
+            break;
+        case 'n':
+            parse_last_records(optarg);
+            break;
+        case 'h':
+            printf("ETF - System software - Trace decoder v1.0\n"
+                    "Usage:\n\t%s [-o output_file] [-n count] [-h] trace_file\n\n", argv[0]);
+            printf("\t-o file\t-- specify output filename (default: standard output)\n"
+                   "\t-n count\t-- decode only the last count records\n"
+                   "\t-h     \t-- print this message and exit\n");
+            exit(EXIT_SUCCESS);
+            break;
+        case '?':
+            if (optopt == 'o' || optopt == 'n')
+            {
+                fprintf(stderr, "Option -%c requires an argument\n", optopt);
+            }
+            else if (optopt == 0)
+            {
+                fprintf(stderr, "Unknown option '%s'\n", argv[optind - 1]);
+            }
+            else if (isprint(optopt))
+            {
+                fprintf(stderr, "Unknown option '-%c'\n", optopt);
+            }
+            else
+            {
+                fprintf(stderr, "Unknown option character '\\x%x'\n", optopt);
+            }
+            exit(EXIT_FAILURE);
+            break;
+        default:
+            abort();
+            break;
+        }
+    }
+
+    int index = optind;
+    if (index == argc)
+    {
+        fprintf(stderr, "%s requires a trace file\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc - index > 1)
+    {
+        fprintf(stderr, "%s allows at most one trace file\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    trace_filename = argv[index];
+}
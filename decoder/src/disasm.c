@@ -0,0 +1,130 @@
+/* File: disasm.c */
+/* Disassembly of single instructions. */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "disasm.h"
+
+/* Instruction fields, see cpu.h of the emulator. */
+#define IR_COND(ir0)     (((ir0) >> 14) & 0x3)
+#define IR_OPCODE(ir0)   (((ir0) >> 10) & 0xf)
+#define IR_DST_MODE(ir0) (((ir0) >> 8) & 0x3)
+#define IR_DST_REG(ir0)  (((ir0) >> 5) & 0x7)
+#define IR_SRC_MODE(ir0) (((ir0) >> 3) & 0x3)
+#define IR_SRC_REG(ir0)  ((ir0) & 0x7)
+
+/* The PSW is addressed as an immediate operand with register field 7. */
+#define PSW_REG 0x7
+
+/* Encoding of HALT: OR<cond> psw, 0x10 */
+#define HALT_IR0 0x18e0
+#define HALT_IR1 0x0010
+
+/* Function find_mnemonic fetches the shortest mnemonic of the instruction table with
+ * opcode opcode and condition cond, starting with prefix if it isn't NULL, so the
+ * unconditional form is "ADD" rather than "ADDAL". */
+static const Instruction *find_mnemonic(Opcode opcode, Condition cond, const char *prefix)
+{
+    const Instruction *best = NULL;
+    int i;
+    for (i = 0; i < instruction_table_size; ++i)
+    {
+        const Instruction *ins = &instruction_table[i];
+        if (ins->opcode != opcode || ins->cond != cond)
+            continue;
+        if (prefix && strncmp(ins->mnemonic, prefix, strlen(prefix)) != 0)
+            continue;
+        if (!best || strlen(ins->mnemonic) < strlen(best->mnemonic))
+            best = ins;
+    }
+    return best;
+}
+
+/* Function append appends the lower case copy of str to buf of size size at *pos. */
+static void append(char *buf, size_t size, size_t *pos, const char *str)
+{
+    while (*str && *pos + 1 < size)
+        buf[(*pos)++] = (char) tolower((unsigned char) *str++);
+    buf[*pos] = '\0';
+}
+
+/* Function format_operand writes the operand with address mode mode and register
+ * field reg to buf, in the syntax of the assembler. */
+static void format_operand(int mode, int reg, uint16_t ir1, int is_long, char *buf, size_t size)
+{
+    if (mode == AM_REGDIR)
+    {
+        snprintf(buf, size, "%s", register_table[reg]);
+    }
+    else if (mode == AM_IMMED && reg == PSW_REG)
+    {
+        snprintf(buf, size, "psw");
+    }
+    else if (!is_long)
+    {
+        /* the second word the operand needs is missing */
+        snprintf(buf, size, "?");
+    }
+    else if (mode == AM_IMMED)
+    {
+        snprintf(buf, size, "%d", (int16_t) ir1);
+    }
+    else if (mode == AM_MEMDIR)
+    {
+        snprintf(buf, size, "*%u", ir1);
+    }
+    else
+    {
+        snprintf(buf, size, "%s[%d]", register_table[reg], (int16_t) ir1);
+    }
+}
+
+void disassemble(uint16_t ir0, uint16_t ir1, int is_long, char *buf, size_t size)
+{
+    Condition cond = (Condition) IR_COND(ir0);
+    Opcode opcode = (Opcode) IR_OPCODE(ir0);
+    int dst_mode = IR_DST_MODE(ir0), dst_reg = IR_DST_REG(ir0);
+    int src_mode = IR_SRC_MODE(ir0), src_reg = IR_SRC_REG(ir0);
+    size_t pos = 0;
+
+    if (size == 0)
+        return;
+    buf[0] = '\0';
+
+    /* pseudoinstructions */
+    if (opcode == OP_POP && dst_mode == AM_REGDIR && dst_reg == 7)
+    {
+        append(buf, size, &pos, find_mnemonic(OP_NONE, cond, "RET")->mnemonic);
+        return;
+    }
+    if ((ir0 & 0x3fff) == HALT_IR0 && is_long && ir1 == HALT_IR1)
+    {
+        append(buf, size, &pos, find_mnemonic(OP_NONE, cond, "HALT")->mnemonic);
+        return;
+    }
+
+    const Instruction *ins = find_mnemonic(opcode, cond, NULL);
+    append(buf, size, &pos, ins->mnemonic);
+
+    char operand[32];
+    if (ins->nparam == 2)
+    {
+        format_operand(dst_mode, dst_reg, ir1, is_long, operand, sizeof(operand));
+        append(buf, size, &pos, " ");
+        append(buf, size, &pos, operand);
+        format_operand(src_mode, src_reg, ir1, is_long, operand, sizeof(operand));
+        append(buf, size, &pos, ", ");
+        append(buf, size, &pos, operand);
+    }
+    else if (ins->nparam == 1)
+    {
+        /* the only operand is encoded in the destination field, whatever its role */
+        format_operand(dst_mode, dst_reg, ir1, is_long, operand, sizeof(operand));
+        append(buf, size, &pos, " ");
+        append(buf, size, &pos, operand);
+    }
+}
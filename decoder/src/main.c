@@ -0,0 +1,129 @@
+/* File: main.c */
+/* System software project: trace decoder */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Note: non-standard headers, available on POSIX systems */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cmdline.h"
+#include "trace_format.h"
+#include "disasm.h"
+
+char *trace_filename = NULL;
+char *out_filename = NULL;
+uint64_t last_records = 0;
+
+/* Function valid_header checks if a trace file of size bytes starts with header hdr. */
+static int valid_header(const TraceHeader *hdr, uint64_t size)
+{
+    return memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) == 0
+        && hdr->version == TRACE_VERSION
+        && hdr->record_size == sizeof(TraceRecord)
+        && hdr->capacity > 0
+        && hdr->capacity <= (size - TRACE_RECORDS_OFFSET) / sizeof(TraceRecord);
+}
+
+/* Function write_record writes record r to out, disassembled. */
+static void write_record(FILE *out, const TraceRecord *r)
+{
+    char insn[64];
+    char ir1[8] = "";
+    int is_long = (r->flags & TRACE_LONG) != 0;
+    if (is_long)
+        snprintf(ir1, sizeof(ir1), "%04x", r->ir1);
+
+    if (r->flags & TRACE_ILLEGAL)
+        snprintf(insn, sizeof(insn), "(illegal)");
+    else
+        disassemble(r->ir0, r->ir1, is_long, insn, sizeof(insn));
+
+    int width = (r->flags & (TRACE_WRITE | TRACE_NOT_TAKEN)) ? 24 : 0;
+    fprintf(out, "%20llu  %04x:  %04x %-4s  %04x  %-*s", (unsigned long long) r->seq,
+            r->pc, r->ir0, ir1, r->psw, width, insn);
+    if (r->flags & TRACE_WRITE)
+        fprintf(out, "  [%04x]", r->write_addr);
+    if (r->flags & TRACE_NOT_TAKEN)
+        fprintf(out, "  (not taken)");
+    fputc('\n', out);
+}
+
+int main(int argc, char *argv[])
+{
+    parse_cmdline(argc, argv);
+
+    int fd = open(trace_filename, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "error: failed to open file '%s'\n", trace_filename);
+        return EXIT_FAILURE;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < TRACE_RECORDS_OFFSET)
+    {
+        fprintf(stderr, "error: '%s' is not a trace file\n", trace_filename);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    size_t size = (size_t) st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "error: failed to map file '%s'\n", trace_filename);
+        return EXIT_FAILURE;
+    }
+
+    const TraceHeader *hdr = map;
+    if (!valid_header(hdr, size))
+    {
+        fprintf(stderr, "error: '%s' is not a version %d trace file\n", trace_filename, TRACE_VERSION);
+        munmap(map, size);
+        return EXIT_FAILURE;
+    }
+    const TraceRecord *ring = (const TraceRecord *)((const unsigned char *) map + TRACE_RECORDS_OFFSET);
+
+    FILE *out = stdout;
+    if (out_filename)
+    {
+        out = fopen(out_filename, "w");
+        if (!out)
+        {
+            fprintf(stderr, "error: failed to open file '%s'\n", out_filename);
+            munmap(map, size);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* the ring holds the last capacity records, the oldest at index written % capacity */
+    uint64_t count = hdr->written < hdr->capacity ? hdr->written : hdr->capacity;
+    if (last_records && last_records < count)
+        count = last_records;
+    uint64_t first = hdr->written - count;
+
+    fprintf(out, "# %llu records written, %llu kept, %llu decoded\n",
+            (unsigned long long) hdr->written,
+            (unsigned long long)(hdr->written < hdr->capacity ? hdr->written : hdr->capacity),
+            (unsigned long long) count);
+    fprintf(out, "#%19s  %-5s  %-9s  %-4s  %s\n", "seq", "pc", "ir0  ir1", "psw", "instruction");
+    uint64_t n;
+    for (n = first; n < hdr->written; ++n)
+        write_record(out, &ring[n % hdr->capacity]);
+
+    int ok = (out != stdout) ? fclose(out) == 0 : fflush(out) == 0;
+    munmap(map, size);
+    if (!ok)
+    {
+        fprintf(stderr, "error: failed to write the decoded trace\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
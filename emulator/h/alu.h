@@ -0,0 +1,352 @@
+/* File: alu.h */
+/* Arithmetic-logic and stack operations shared by the execution engines. */
+
+#ifndef ALU_H
+#define ALU_H
+
+#include <stdint.h>
+
+#include "vm.h"
+#include "constants.h"
+#include "icache.h"
+#include "mmio.h"
+
+static inline int test_carry16(int16_t a, int16_t b)
+{
+    int carry = 0;
+    int i;
+    for (i = 0; i < 16; ++i)
+        carry = ((a >> i) & 1) + ((b >> i) & 1) + carry > 1;
+    return carry;
+}
+
+static inline void set_zn(struct vm *vm, int16_t result)
+{
+    if (result == 0)
+        PSW_SET_FLAG(vm, PSW_FLAG_Z);
+    else
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_Z);
+
+    if (result < 0)
+        PSW_SET_FLAG(vm, PSW_FLAG_N);
+    else
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_N);
+}
+
+static inline void set_co_add(struct vm *vm, int16_t a, int16_t b)
+{
+    if (test_carry16(a, b))
+        PSW_SET_FLAG(vm, PSW_FLAG_C);
+    else
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_C);
+
+    int16_t res = a + b;
+    if ((a < 0 && b < 0 && !(res < 0)) || (a > 0 && b > 0 && !(res > 0)))
+        PSW_SET_FLAG(vm, PSW_FLAG_O);
+    else
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_O);
+}
+
+static inline void set_co_sub(struct vm *vm, int16_t a, int16_t b)
+{
+    if (test_carry16(a, -b))
+        PSW_SET_FLAG(vm, PSW_FLAG_C);
+    else
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_C);
+
+    int16_t res = a - b;
+    if (b == INT16_MIN)
+    {
+        PSW_SET_FLAG(vm, PSW_FLAG_O);
+    }
+    else
+    {
+        if ((a < 0 && -b < 0 && !(res < 0)) || (a > 0 && -b > 0 && !(res > 0)))
+            PSW_SET_FLAG(vm, PSW_FLAG_O);
+        else
+            PSW_CLEAR_FLAG(vm, PSW_FLAG_O);
+    }
+}
+
+/* Function psw_sync applies pending flag updates to the PSW. It has to be called
+ * before the PSW is read or written as a whole. */
+static inline void psw_sync(struct vm *vm)
+{
+    struct lazy_flags_t *f = &vm->cpu_context.flags;
+
+    if (f->co == FLAGS_CO_ADD)
+        set_co_add(vm, f->a, f->b);
+    else if (f->co == FLAGS_CO_SUB)
+        set_co_sub(vm, f->a, f->b);
+    f->co = FLAGS_CO_NONE;
+
+    if (f->zn)
+        set_zn(vm, f->res);
+    f->zn = 0;
+}
+
+/* Function update_zn records result as the source of Z and N. */
+static inline void update_zn(struct vm *vm, int16_t result)
+{
+    vm->cpu_context.flags.res = result;
+    vm->cpu_context.flags.zn = 1;
+}
+
+/* Function update_co records a and b as the operands C and O are derived from. */
+static inline void update_co(struct vm *vm, int op, int16_t a, int16_t b)
+{
+    vm->cpu_context.flags.a = a;
+    vm->cpu_context.flags.b = b;
+    vm->cpu_context.flags.co = op;
+}
+
+/* ADD and SUB with a PSW operand see the flags as they are updated, and
+ * a PSW destination is overwritten with the result after the flags are set. */
+static inline void alu_add_psw(struct vm *vm, int16_t *dst, int16_t *src)
+{
+    psw_sync(vm);
+
+    if (test_carry16(*dst, *src))
+        PSW_SET_FLAG(vm, PSW_FLAG_C);
+    else
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_C);
+
+    int16_t res = *dst + *src;
+    if ((*dst < 0 && *src < 0 && !(res < 0)) || (*dst > 0 && *src > 0 && !(res > 0)))
+        PSW_SET_FLAG(vm, PSW_FLAG_O);
+    else
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_O);
+
+    set_zn(vm, res);
+
+    *dst = res;
+}
+
+static inline void alu_sub_psw(struct vm *vm, int16_t *dst, int16_t *src)
+{
+    psw_sync(vm);
+
+    if (test_carry16(*dst, -(*src)))
+        PSW_SET_FLAG(vm, PSW_FLAG_C);
+    else
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_C);
+
+    int16_t res = *dst - *src;
+    if (*src == INT16_MIN)
+    {
+        PSW_SET_FLAG(vm, PSW_FLAG_O);
+    }
+    else
+    {
+        if ((*dst < 0 && -(*src) < 0 && !(res < 0)) || (*dst > 0 && -(*src) > 0 && !(res > 0)))
+            PSW_SET_FLAG(vm, PSW_FLAG_O);
+        else
+            PSW_CLEAR_FLAG(vm, PSW_FLAG_O);
+    }
+
+    set_zn(vm, res);
+
+    *dst = res;
+}
+
+static inline void alu_add(struct vm *vm, int16_t *dst, int16_t *src)
+{
+    if (dst == &vm->cpu_context.psw || src == &vm->cpu_context.psw)
+    {
+        alu_add_psw(vm, dst, src);
+        return;
+    }
+
+    int16_t res = *dst + *src;
+    update_co(vm, FLAGS_CO_ADD, *dst, *src);
+    update_zn(vm, res);
+
+    *dst = res;
+}
+
+static inline void alu_sub(struct vm *vm, int16_t *dst, int16_t *src)
+{
+    if (dst == &vm->cpu_context.psw || src == &vm->cpu_context.psw)
+    {
+        alu_sub_psw(vm, dst, src);
+        return;
+    }
+
+    int16_t res = *dst - *src;
+    update_co(vm, FLAGS_CO_SUB, *dst, *src);
+    update_zn(vm, res);
+
+    *dst = res;
+}
+
+static inline void alu_cmp(struct vm *vm, int16_t a, int16_t b)
+{
+    update_co(vm, FLAGS_CO_SUB, a, b);
+    update_zn(vm, a - b);
+}
+
+static inline void alu_mul(struct vm *vm, int16_t *dst, int16_t *src)
+{
+    *dst = *dst * *src;
+    update_zn(vm, *dst);
+}
+
+static inline void alu_div(struct vm *vm, int16_t *dst, int16_t *src)
+{
+    *dst = *dst / *src;
+    update_zn(vm, *dst);
+}
+
+static inline void alu_and(struct vm *vm, int16_t *dst, int16_t *src)
+{
+    *dst = *dst & *src;
+    update_zn(vm, *dst);
+}
+
+static inline void alu_test(struct vm *vm, int16_t a, int16_t b)
+{
+    update_zn(vm, a & b);
+}
+
+static inline void alu_or(struct vm *vm, int16_t *dst, int16_t *src)
+{
+    *dst = *dst | *src;
+    update_zn(vm, *dst);
+}
+
+static inline void alu_not(struct vm *vm, int16_t *dst)
+{
+    *dst = ~(*dst);
+    update_zn(vm, *dst);
+}
+
+static inline void alu_shl(struct vm *vm, int16_t *dst, uint16_t *src)
+{
+    psw_sync(vm);
+
+    if (*src == 0)
+    {
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_C);
+        return;
+    }
+
+    if (*src > 16)
+    {
+        *dst = 0;
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_C);
+        return;
+    }
+
+    int carry = (*dst & (1 << (16 - *src))) > 0;
+    if (carry)
+        PSW_SET_FLAG(vm, PSW_FLAG_C);
+    else
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_C);
+
+    *dst = *dst << *src;
+}
+
+static inline void alu_shr(struct vm *vm, int16_t *dst, uint16_t *src)
+{
+    psw_sync(vm);
+
+    if (*src == 0)
+    {
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_C);
+        return;
+    }
+
+    if (*src > 16)
+    {
+        if (*dst & 0x8000)
+        {
+            *dst = (int16_t) 0xffff;
+            PSW_SET_FLAG(vm, PSW_FLAG_C);
+        }
+        else
+        {
+            *dst = 0;
+            PSW_CLEAR_FLAG(vm, PSW_FLAG_C);
+        }
+        return;
+    }
+
+    int carry = (*dst & (1 << (*src - 1))) > 0;
+    if (carry)
+        PSW_SET_FLAG(vm, PSW_FLAG_C);
+    else
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_C);
+
+    *dst = *dst >> *src;
+}
+
+static inline void push(struct vm *vm, int16_t src)
+{
+    char *byte = (char *) &src;
+    vm->cpu_context.reg[6] = (int16_t)(vm->cpu_context.reg[6] - 2);
+    /* stored like a word operand, so a word at 0xffff goes through the guard page (mem.h) */
+    unsigned char *top = vm->mem + (uint16_t) vm->cpu_context.reg[6];
+    *(top + 1) = *(byte + 1);
+    *top = *byte;
+    icache_write(vm, (uint16_t) vm->cpu_context.reg[6]);
+    mmio_write(vm, (uint16_t) vm->cpu_context.reg[6]);
+}
+
+static inline void pop(struct vm *vm, int16_t *dst)
+{
+    char *byte = (char *) dst;
+    mmio_read(vm, (uint16_t) vm->cpu_context.reg[6]);
+    unsigned char *top = vm->mem + (uint16_t) vm->cpu_context.reg[6];
+    *byte = *top;
+    *(byte + 1) = *(top + 1);
+    vm->cpu_context.reg[6] = (int16_t)(vm->cpu_context.reg[6] + 2);
+}
+
+static inline void call(struct vm *vm, int16_t address)
+{
+    push(vm, vm->cpu_context.reg[7]);
+    vm->cpu_context.reg[7] = address;
+}
+
+static inline void iret(struct vm *vm)
+{
+    psw_sync(vm);
+    pop(vm, &vm->cpu_context.psw);
+    pop(vm, &vm->cpu_context.reg[7]);
+}
+
+static inline void alu_mov(struct vm *vm, int16_t *dst, int16_t *src)
+{
+    *dst = *src;
+    update_zn(vm, *dst);
+}
+
+static inline int test_condition(struct vm *vm, int cond)
+{
+    /* Z and N can be read from a pending result without updating the PSW */
+    const struct lazy_flags_t *f = &vm->cpu_context.flags;
+    int z = f->zn ? (f->res == 0) : (PSW_TEST_FLAG(vm, PSW_FLAG_Z) != 0);
+    int n = f->zn ? (f->res < 0) : (PSW_TEST_FLAG(vm, PSW_FLAG_N) != 0);
+
+    switch(cond)
+    {
+    case EQ:
+        if (!z)
+            return 0;
+        break;
+    case NE:
+        if (z)
+            return 0;
+        break;
+    case GT:
+        if (z || n)
+            return 0;
+        break;
+    case AL:
+        return 1;
+        break;
+    }
+    return 1;
+}
+
+#endif /* ALU_H */
@@ -0,0 +1,72 @@
+/* File: block.h */
+/* Block storage device. */
+
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+
+#include "vm.h"
+
+/* Size of a disk sector, in bytes. */
+#define BLOCK_SECTOR_SIZE 512
+
+/* Device registers, one word each. */
+#define BLOCK_SECTOR_REGISTER ((uint16_t) 0xff80)  /* first sector of the transfer */
+#define BLOCK_ADDRESS_REGISTER ((uint16_t) 0xff82) /* guest memory address of the transfer */
+#define BLOCK_COUNT_REGISTER ((uint16_t) 0xff84)   /* number of sectors */
+#define BLOCK_COMMAND_REGISTER ((uint16_t) 0xff86) /* writing a command starts the transfer */
+#define BLOCK_STATUS_REGISTER ((uint16_t) 0xff88)  /* read only */
+
+/* Commands. */
+enum {
+    BLOCK_READ = 1,  /* copy sectors from the disk to memory */
+    BLOCK_WRITE = 2, /* copy memory to sectors of the disk */
+};
+
+/* Status. */
+enum {
+    BLOCK_READY = 0, /* the last command, if any, succeeded */
+    BLOCK_BUSY = 1,  /* a command is running */
+    BLOCK_ERROR = 2, /* the last command was invalid, or out of the disk or below the MMIO page */
+};
+
+/* Number of retired instructions a command takes, whatever its size. */
+#define BLOCK_LATENCY 64
+
+/* Number of retired instructions between two attempts to raise the completion interrupt
+ * while the CPU can't take it. */
+#define BLOCK_RETRY_INTERVAL 64
+
+/* With options.disk_filename set, the machine has a disk: the file, mapped
+ * into the emulator and divided into BLOCK_SECTOR_SIZE sectors, of which
+ * only the first 65536 are addressable. Writes go straight to the file. It is
+ * opened read-only if it can't be written, and write commands then fail.
+ *
+ * A guest fills in the sector, address and count registers and writes a command.
+ * The status turns BLOCK_BUSY, and BLOCK_LATENCY instructions later the device
+ * copies the whole transfer at once, sets the status and raises the interrupt at
+ * BLOCK_DEVICE_IVTENTRY as soon as the CPU can take it. Commands written while the
+ * device is busy are ignored. A transfer must fit below the MMIO page.
+ *
+ * Transfers are timed in retired instructions, so replaying an event log with
+ * the disk as it was when the log was recorded reproduces them. A snapshot of a
+ * busy device restarts its command when restored; a completion interrupt not yet
+ * raised is lost. */
+
+/* Function init_block_device maps the disk of vm and attaches its registers, if its options
+ * ask for one. Returns 0 on failure. */
+int init_block_device(struct vm *vm);
+
+/* Function close_block_device unmaps the disk of vm. */
+void close_block_device(struct vm *vm);
+
+/* Function block_pending checks if vm has a command running or a completion interrupt
+ * waiting, so the CPU must not sleep. */
+int block_pending(struct vm *vm);
+
+/* Function restart_block_device schedules the command of a busy device again after the
+ * state of vm was replaced by a snapshot. */
+void restart_block_device(struct vm *vm);
+
+#endif /* BLOCK_H */
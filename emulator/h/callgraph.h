@@ -0,0 +1,56 @@
+/* File: callgraph.h */
+/* Function-level profile: shadow call stack of the guest. */
+
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vm.h"
+
+/* Maximum depth of the shadow call stack. Deeper calls are charged to the innermost frame. */
+#define CALLGRAPH_MAX_DEPTH 32768
+
+/* Maximum number of distinct call paths. Paths found after that are charged to their caller. */
+#define CALLGRAPH_MAX_NODES (1 << 20)
+
+/* A machine run with options.callgraph set keeps a shadow call stack. CALL
+ * pushes a frame named after its target, and interrupt entry pushes a frame
+ * named after the routine, under a root of its own for the IVT entry, so
+ * interrupt routines are never charged to the code they interrupt. POP into
+ * R7 (the RET idiom) pops the frame whose return address and stack pointer
+ * it matches, and IRET pops the innermost interrupt frame along with any
+ * frames left above it. Every retired instruction is charged to the call
+ * path of the innermost frame. */
+
+/* Function init_callgraph allocates the call graph of vm if its options ask for it.
+ * Returns 0 on failure. */
+int init_callgraph(struct vm *vm);
+
+/* Function close_callgraph frees the call graph of vm. */
+void close_callgraph(struct vm *vm);
+
+/* Function callgraph_start pushes the outermost frame, named after the current PC,
+ * unless the stack already holds one. */
+void callgraph_start(struct vm *vm);
+
+/* Hooks called by the engines after the named instruction was executed,
+ * before it is counted in vm->retired, and by interrupt after entering a routine. */
+void callgraph_call(struct vm *vm);
+void callgraph_return(struct vm *vm);
+void callgraph_iret(struct vm *vm);
+void callgraph_interrupt(struct vm *vm);
+
+/* Function callgraph_top returns the address called by the innermost frame of vm,
+ * the interrupt routine for an interrupt frame. */
+uint16_t callgraph_top(struct vm *vm);
+
+/* Function write_callgraph writes the call graph of vm, with the symbols of executable
+ * file bin (NULL if there is none). File report_filename gets the inclusive and exclusive
+ * instruction counts per symbol, sorted by inclusive count, and file folded_filename the
+ * instruction counts per call path in the folded-stack format of flame-graph tools.
+ * Either name may be NULL. Returns 0 on failure. */
+int write_callgraph(struct vm *vm, FILE *bin, const char *report_filename, const char *folded_filename);
+
+#endif /* CALLGRAPH_H */
@@ -6,8 +6,23 @@
 
 #include <stdio.h>
 
-/* Function run initializes and runs the emulation. */
-void run(FILE *bin);
+#include "vm.h"
+
+/* Execution engines. */
+enum {
+    ENGINE_INTERP = 0,   /* fetch/decode/execute loop */
+    ENGINE_THREADED = 1, /* threaded-code dispatch, see threaded.h */
+    ENGINE_JIT = 2,      /* basic-block translation to host code, see jit.h */
+};
+
+/* Function run loads executable file bin into vm, resets the CPU and resumes it.
+ * Returns 0 if bin can't be run. */
+int run(struct vm *vm, FILE *bin);
+
+/* Function resume runs vm from its current state until the CPU halts or, if
+ * vm->options.max_insns is set, until that many more instructions are retired.
+ * In the latter case vm->out_of_budget is set and the machine can be resumed again. */
+void resume(struct vm *vm);
 
 #endif /* CONTROL_H */
 
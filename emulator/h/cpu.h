@@ -30,46 +30,50 @@
 #define PSW_FLAG_T 0x2000 /* timer interrupt switch */
 #define PSW_FLAG_I 0x8000 /* interrupt mask */
 
-#define PSW_SET_FLAG(flag) ((cpu_context.psw) |= (flag))
-#define PSW_CLEAR_FLAG(flag) ((cpu_context.psw) &= ~(flag))
-#define PSW_TEST_FLAG(flag) ((cpu_context.psw) & (flag))
+#define PSW_SET_FLAG(vm, flag) (((vm)->cpu_context.psw) |= (flag))
+#define PSW_CLEAR_FLAG(vm, flag) (((vm)->cpu_context.psw) &= ~(flag))
+#define PSW_TEST_FLAG(vm, flag) (((vm)->cpu_context.psw) & (flag))
 
 /* Input/output devices. */
 #define OUTPUT_DEVICE_ADDRESS ((uint16_t) 0xfffe)
 #define INPUT_DEVICE_ADDRESS ((uint16_t) 0xfffc)
+#define OUTPUT_DMA_ADDRESS ((uint16_t) 0xfff8) /* buffer address register */
+#define OUTPUT_DMA_LENGTH ((uint16_t) 0xfffa)  /* buffer length register */
 
-/* Timer tick period in seconds. */
-#define TIMER_PERIOD_IN_SEC 1
+/* Default timer tick period, in retired instructions and in milliseconds. */
+#define TIMER_PERIOD_IN_INSNS 1000000
+#define TIMER_PERIOD_IN_MS 1000
 
 /* Default IVT entries. */
 #define CPU_RESET_IVTENTRY 0
 #define TIMER_TICK_IVTENTRY 1
 #define ILLEGAL_INSTRUCTION_IVTENTRY 2
 #define INPUT_DEVICE_IVTENTRY 3
-
-#define ILLEGAL_INSTRUCTION ((intr) && (ivtentry == ILLEGAL_INSTRUCTION_IVTENTRY))
+#define BLOCK_DEVICE_IVTENTRY 4
+#define NET_DEVICE_IVTENTRY 5
+
+#define ILLEGAL_INSTRUCTION(vm) (((vm)->intr) && ((vm)->ivtentry == ILLEGAL_INSTRUCTION_IVTENTRY))
+
+/* Lazily evaluated PSW flags. ALU operations record their operands and result
+ * here instead of computing Z, N, C and O; see psw_sync in alu.h. */
+#define FLAGS_CO_NONE 0
+#define FLAGS_CO_ADD 1
+#define FLAGS_CO_SUB 2
+
+struct lazy_flags_t {
+    int16_t a;      /* operands C and O are derived from */
+    int16_t b;
+    int16_t res;    /* result Z and N are derived from */
+    uint8_t zn;     /* Z and N are pending */
+    uint8_t co;     /* C and O are pending: FLAGS_CO_ADD or FLAGS_CO_SUB */
+};
 
 /* CPU context definition. */
 /* General purpose registers and program status word. */
 struct cpu_context_t {
     int16_t reg[8];
     int16_t psw;
+    struct lazy_flags_t flags;
 };
-extern struct cpu_context_t cpu_context;
-
-/* Instruction registers. */
-extern int16_t ir0;
-extern int16_t ir1;
-
-/* Memory address register. */
-extern uint16_t mar;
-
-/* Operand addresses. */
-extern int16_t *operand[2];
-
-/* Interrupt Vector Table Pointer. */
-extern int16_t ivtp;
-extern int16_t ivtentry;
 
 #endif /* CPU_H */
-
@@ -4,11 +4,10 @@
 #ifndef DECODE_H
 #define DECODE_H
 
-/* Flag indicating if memory address is decoded as destination. */
-extern int memory_dst;
+#include "vm.h"
 
 /* Function decode determines operand addresses. */
-void decode(void);
+void decode(struct vm *vm);
 
 #endif /* DECODE_H */
 
@@ -4,23 +4,79 @@
 #ifndef DEVICES_H
 #define DEVICES_H
 
-#define INPUT_BUFFER_SIZE 1024
+#include <stdint.h>
 
-/* Function signal_output_device sends a byte to the output device if
- * any data was written to memory address OUTPUT_DEVICE_ADDRESS. */
-void signal_output_device(void);
+#include "vm.h"
 
-/* Function poll_input_device checks with the input device if new byte
- * is ready at the input, to be stored at memory addresss INPUT_DEVICE_ADDRESS. */
-void poll_input_device(void);
+#define INPUT_BUFFER_SIZE 1024 /* must be a power of two */
+#define OUTPUT_BUFFER_SIZE 4096
 
-/* Function init_time initializes CPU timer. */
-void init_timer(void);
+/* Number of retired instructions between two checks of the input buffer. */
+#define INPUT_POLL_INTERVAL 1024
 
-/* Function poll_timer checks with the timer
- * if TIMER_PERIOD_IN_SEC seconds has passed. */
-void poll_timer(void);
+/* Function init_output_device attaches the output data register at OUTPUT_DEVICE_ADDRESS
+ * and the buffer registers at OUTPUT_DMA_ADDRESS and OUTPUT_DMA_LENGTH, and sets up output
+ * buffering. Writing the length register sends that many bytes of memory from the address
+ * in the address register at once, as if each had been written to the data register;
+ * bytes from the MMIO page on aren't sent. Output is flushed at the end of every line
+ * if the output file is a terminal, once per buffer, when the guest may be waiting for
+ * input, and when the device is closed. Returns 0 on failure. */
+int init_output_device(struct vm *vm);
 
-#endif /* DEVICES_H */
+/* Function close_output_device flushes buffered output and frees the console. */
+void close_output_device(struct vm *vm);
+
+/* Function output_device sends byte ch to the output device. */
+void output_device(struct vm *vm, char ch);
+
+/* Function flush_output writes buffered output to the output file. */
+void flush_output(struct vm *vm);
+
+/* Function stop_signal_caught returns the number of the signal that asked the emulator
+ * to stop, 0 if none was caught. The CPU of every machine stops at its next console
+ * check once one is. */
+int stop_signal_caught(void);
+
+/* Function input_device stores byte ch in the input data register at INPUT_DEVICE_ADDRESS
+ * and raises the input interrupt. */
+void input_device(struct vm *vm, char ch);
+
+/* Function init_input_device attaches the input data register, starts the thread reading the input
+ * file into the input buffer, unless it is a regular file or vm replays an event log, and schedules
+ * the first check of the buffer.
+ * Must be called after init_output_device. Returns 0 on failure. */
+int init_input_device(struct vm *vm);
+
+/* Function close_input_device stops the reader thread. The input file is left open. */
+void close_input_device(struct vm *vm);
 
+/* Timer modes. */
+enum {
+    TIMER_VIRTUAL = 0,    /* tick every timer_period retired instructions */
+    TIMER_WALL_CLOCK = 1, /* tick every timer_period milliseconds of CLOCK_MONOTONIC time */
+};
 
+/* Number of retired instructions between two clock reads in wall-clock mode. */
+#define WALL_CLOCK_CHECK_INTERVAL 1024
+
+/* Function init_timer initializes CPU timer and schedules its first tick, unless vm replays
+ * an event log. Returns 0 on failure. */
+int init_timer(struct vm *vm);
+
+/* Function close_timer frees the timer of vm. */
+void close_timer(struct vm *vm);
+
+/* Function wait_for_devices sleeps until the next wall-clock timer tick is due, input or
+ * a packet arrives or a stop signal is caught, whichever comes first. Called by an idle
+ * CPU, see idle.h. */
+void wait_for_devices(struct vm *vm);
+
+/* Function timer_remaining returns the time until the next timer tick,
+ * in units of vm->options.timer_mode. */
+uint64_t timer_remaining(struct vm *vm);
+
+/* Function restart_devices schedules the device events again after the state
+ * of vm was replaced by a snapshot, with the next timer tick timer_remaining away. */
+void restart_devices(struct vm *vm, uint64_t timer_remaining);
+
+#endif /* DEVICES_H */
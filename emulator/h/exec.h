@@ -4,12 +4,10 @@
 #ifndef EXEC_H
 #define EXEC_H
 
-/* Flag indicating if explicit write to memory was performed.
- * Push to stack isn't considered as explicit write to memory. */
-int memory_write;
+#include "vm.h"
 
 /* Function execute executes an instruction on decoded operands. */
-void execute(void);
+void execute(struct vm *vm);
 
 #endif /* EXEC_H */
 
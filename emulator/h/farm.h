@@ -0,0 +1,27 @@
+/* File: farm.h */
+/* Parallel batch runner. */
+
+#ifndef FARM_H
+#define FARM_H
+
+#include "vm.h"
+
+/* Maximum number of worker threads. */
+#define FARM_MAX_WORKERS 256
+
+/* Maximum length of a manifest line. */
+#define FARM_MAX_LINE 4096
+
+/* Function run_farm runs every job of manifest file manifest_filename, each in a
+ * machine of its own created with options, on nworkers threads (0 for one per
+ * online CPU). A manifest line names an executable or a snapshot, an input file,
+ * an instruction budget and a file with the expected output, separated by whitespace. Trailing
+ * fields may be left out and '-' stands for none; empty lines and lines starting
+ * with '#' are skipped. Per-job results are written to results_filename (standard
+ * output if NULL), as JSON if its name ends with ".json" and as CSV otherwise.
+ * Returns EXIT_SUCCESS if every job halted within its budget and produced the
+ * expected output, EXIT_FAILURE otherwise. */
+int run_farm(const char *manifest_filename, const char *results_filename, int nworkers,
+             const struct vm_options *options, int exit_register);
+
+#endif /* FARM_H */
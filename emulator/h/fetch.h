@@ -4,8 +4,10 @@
 #ifndef FETCH_H
 #define FETCH_H
 
+#include "vm.h"
+
 /* Function fetch reads next instruction into instruction registers. */
-void fetch(void);
+void fetch(struct vm *vm);
 
 #endif /* FETCH_H */
 
@@ -0,0 +1,107 @@
+/* File: icache.h */
+/* Predecoded instruction cache. */
+
+#ifndef ICACHE_H
+#define ICACHE_H
+
+#include <stdint.h>
+
+#include "vm.h"
+
+/* Resolved operand kinds. */
+enum {
+    OPND_IMMED = 0x0,  /* immediate data from the second instruction word */
+    OPND_PSW = 0x1,    /* IMMED addressed operand with register field 0x7 */
+    OPND_REG = 0x2,    /* REGDIR */
+    OPND_MEM = 0x3,    /* MEMDIR */
+    OPND_REGIND = 0x4, /* REGINDDISP */
+};
+
+/* Predecoded instruction, keyed by the address of its first byte. */
+struct icache_entry {
+    int16_t ir0;        /* first instruction word */
+    int16_t ir1;        /* address, offset or immediate data */
+    uint8_t valid;
+    uint8_t opcode;
+    uint8_t cond;
+    uint8_t len;        /* INSTRUCTION_SIZE or INSTRUCTION_SIZE_LONG */
+    uint8_t span;       /* bytes covered: len, or the length of a fused sequence */
+    uint8_t kind[2];    /* OPND_* for destination and source */
+    uint8_t reg[2];     /* register index for destination and source */
+    uint8_t illegal;    /* IMMED destination of an instruction other than PUSH/IRET */
+    uint8_t handler;    /* threaded engine handler, see ICACHE_HANDLER */
+};
+
+/* Threaded engine handlers are indexed by opcode and destination operand kind. */
+#define ICACHE_NUM_KINDS 5
+#define ICACHE_HANDLER(opcode, kind) ((opcode) * ICACHE_NUM_KINDS + (kind))
+#define ICACHE_HANDLER_ILLEGAL ICACHE_HANDLER(16, 0)
+
+/* Fused handlers of the threaded engine run a sequence of instructions, the
+ * entry's and those that follow it in memory, without a dispatch in between.
+ * The sequences are the hottest ones in profiles of the examples, and an entry
+ * is fused only if its instruction always falls through to the next one:
+ *
+ *     MOV rN, x; CMP rM, y; Jcc    load, compare and branch
+ *     CMP rN, x; Jcc               compare and branch
+ *     PUSH rN; PUSH rM
+ *     POP rN; POP rM
+ *     POP rN; RET
+ *     MOV rN, x; MOV *65534, rM    store to the output device
+ *     MOV rN, x; MOV rM, y
+ *
+ * where rN and rM are other than R7, all but the branch are unconditional and
+ * Jcc is JMP<cond> with an immediate operand (MOV<cond> r7, imm or ADD<cond> r7, imm).
+ * A fused entry spans the bytes of the whole sequence, so a write to any of
+ * them drops it; the instructions after the first keep their own entries. */
+enum {
+    ICACHE_FUSED_MOV_CMP_JCC = ICACHE_HANDLER_ILLEGAL + 1,
+    ICACHE_FUSED_CMP_JCC,
+    ICACHE_FUSED_PUSH_PUSH,
+    ICACHE_FUSED_POP_POP,
+    ICACHE_FUSED_POP_RET,
+    ICACHE_FUSED_MOV_OUT,
+    ICACHE_FUSED_MOV_MOV,
+    ICACHE_JCC,         /* unfused Jcc, which checks for idle loops, see idle.h */
+};
+
+/* Maximum number of bytes an entry spans, a fused sequence of three long instructions. */
+#define ICACHE_MAX_SPAN 12
+
+/* The cache of a machine is vm->icache, one entry per address. vm->icache_code_map
+ * holds the number of valid entries covering each byte of memory, and
+ * vm->icache_generation is incremented every time a valid entry is dropped.
+ * Entries are fused only while vm->icache_fusion is set. */
+
+/* Function init_icache allocates the cache of vm. Returns 0 on failure. */
+int init_icache(struct vm *vm);
+
+/* Function close_icache frees the cache of vm. */
+void close_icache(struct vm *vm);
+
+/* Function predecode decodes the instruction at address pc into its cache entry. */
+struct icache_entry *predecode(struct vm *vm, uint16_t pc);
+
+/* Function icache_lookup returns the cache entry for the instruction at address pc. */
+static inline struct icache_entry *icache_lookup(struct vm *vm, uint16_t pc)
+{
+    struct icache_entry *entry = &vm->icache[pc];
+    return entry->valid ? entry : predecode(vm, pc);
+}
+
+/* Function icache_invalidate drops all entries covering address addr. */
+void icache_invalidate(struct vm *vm, uint16_t addr);
+
+/* Function icache_flush drops all entries. */
+void icache_flush(struct vm *vm);
+
+/* Function icache_write must be called after a word is written to memory at address addr. */
+static inline void icache_write(struct vm *vm, uint16_t addr)
+{
+    if (vm->icache_code_map[addr])
+        icache_invalidate(vm, addr);
+    if (vm->icache_code_map[(uint16_t)(addr + 1)])
+        icache_invalidate(vm, (uint16_t)(addr + 1));
+}
+
+#endif /* ICACHE_H */
@@ -0,0 +1,63 @@
+/* File: idle.h */
+/* Idle loop detection and fast-forward. */
+
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdint.h>
+
+#include "vm.h"
+
+/* Longest idle loop, in instructions, the branch included. */
+#define IDLE_MAX_INSNS 8
+
+/* A guest waiting for an interrupt spins in a small loop, such as
+ *
+ *     wait:   jmp $wait
+ *
+ *     wait:   mov r0, flag
+ *             cmp r0, 0
+ *             jmpeq $wait
+ *
+ * An idle loop is a straight run of unconditional CMP, TEST and MOV to R0-R6
+ * instructions ending with a backward JMP<cond> with an immediate operand to
+ * its first instruction. The loop doesn't write memory, its operands don't
+ * address the MMIO page or memory through R0-R6, and its MOVs don't read the
+ * PSW or a register the loop writes. After one full iteration, every further
+ * one leaves the machine exactly as it found it, until a device event changes
+ * something.
+ *
+ * Once the CPU has run a full iteration with interrupts enabled and none pending,
+ * the engines skip whole iterations up to the next scheduled event, as if they had
+ * been executed: vm->retired and the profile counters advance as usual, so every
+ * engine still retires the same instruction stream. In wall-clock timer mode the CPU
+ * first sleeps until the next tick is due, input arrives or a stop signal, unless
+ * vm stops after options.max_insns, replays an event log or waits for its disk or
+ * packet device. A traced machine runs every iteration.
+ *
+ * The last branch checked is cached in vm->idle_pc, vm->idle_generation (the value of
+ * vm->icache_generation it was checked at), vm->idle_insns (the length of the loop it
+ * closes, 0 if it doesn't close one) and vm->idle_retired (vm->retired when it last jumped). */
+
+/* Function idle_loop returns the number of instructions of the idle loop closed by
+ * the instruction at address pc, 0 if it doesn't close one. */
+int idle_loop(struct vm *vm, uint16_t pc);
+
+/* Function idle_check is the slow path of idle_branch. */
+void idle_check(struct vm *vm, uint16_t pc);
+
+/* Function idle_branch must be called by the engines when the instruction at address pc,
+ * a JMP<cond> with an immediate operand (an ICACHE_JCC entry, alone or fused), jumped
+ * backward, after it executed and before it is retired. Other control transfers, such as
+ * RET or a jump through a register, can't close an idle loop, and every engine leaves
+ * them out, so the engines check the same branches and skip the same iterations. The jit
+ * engine checks only the branches that close a block forming an idle loop, which skips
+ * the same iterations: no other branch runs between two iterations of such a loop.
+ * It returns at once for the branch of a busy loop. */
+static inline void idle_branch(struct vm *vm, uint16_t pc)
+{
+    if (pc != vm->idle_pc || vm->idle_generation != vm->icache_generation || vm->idle_insns)
+        idle_check(vm, pc);
+}
+
+#endif /* IDLE_H */
@@ -4,12 +4,12 @@
 #ifndef INTR_H
 #define INTR_H
 
-#define IVTENTRY_SIZE 2
+#include "vm.h"
 
-extern int intr;
+#define IVTENTRY_SIZE 2
 
 /* Function interrup handles interrupt signals
  * by calling interrupt routines. */
-void interrupt(void);
+void interrupt(struct vm *vm);
 
 #endif /* INTR_H */
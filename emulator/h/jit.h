@@ -0,0 +1,24 @@
+/* File: jit.h */
+/* Basic-block translator from guest code to x86-64. */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "vm.h"
+
+/* Size of the executable buffer holding translated blocks. */
+#define JIT_BUFFER_SIZE (16 * 1024 * 1024)
+
+/* Maximum number of guest instructions in one translated block. */
+#define JIT_MAX_BLOCK_INSNS 64
+
+/* Function run_jit translates guest basic blocks into host code on first use
+ * and runs them until the CPU halts. Blocks end at writes to R7, CALL, IRET,
+ * conditional jumps and PSW writes, and are chained to statically known successors.
+ * On hosts other than x86-64 it falls back to the threaded engine. */
+void run_jit(struct vm *vm);
+
+/* Function close_jit frees the translated code of vm, if any. */
+void close_jit(struct vm *vm);
+
+#endif /* JIT_H */
@@ -4,7 +4,14 @@
 #ifndef MEM_H
 #define MEM_H
 
-extern unsigned char mem[]; /* 2^16 B */
+#include <stdint.h>
 
-#endif /* MEM_H */
+#define MEM_SIZE (UINT16_MAX + 1) /* 2^16 B */
+
+/* Size of the guard page mapped right after memory. A word access at address
+ * 0xffff reaches its high byte through a pointer into memory, so the first byte
+ * of the guard page stands in for address 0: the MMIO page, which holds 0xffff,
+ * copies it from address 0 before such a read and back after such a write. */
+#define MEM_GUARD_SIZE 4096
 
+#endif /* MEM_H */
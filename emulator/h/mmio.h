@@ -0,0 +1,69 @@
+/* File: mmio.h */
+/* Memory-mapped device registers. */
+
+#ifndef MMIO_H
+#define MMIO_H
+
+#include <stdint.h>
+
+#include "vm.h"
+
+/* Device registers live in the top MMIO_SIZE bytes of memory, above the initial
+ * stack pointer 0xff7f. */
+#define MMIO_BASE ((uint16_t) 0xff80)
+#define MMIO_SIZE 0x80
+
+/* Callback of a device register, passed the address of its first byte. */
+typedef void (*mmio_callback)(struct vm *vm, uint16_t reg);
+
+/* A device register is a run of bytes of the MMIO page, stored in vm->mem like
+ * any other memory. Its read callback is called before the CPU reads any of its
+ * bytes, to update them, and its write callback after the CPU wrote any of them,
+ * once per instruction even if it wrote all of them. A word access touches every
+ * register it straddles, in address order. The CPU accesses the register like
+ * memory if a callback is NULL.
+ *
+ * Instruction operands, PUSH, POP, CALL and interrupts are dispatched. Instruction
+ * fetch isn't. */
+
+/* Function init_mmio creates the empty register table of vm. Returns 0 on failure. */
+int init_mmio(struct vm *vm);
+
+/* Function close_mmio frees the register table of vm. */
+void close_mmio(struct vm *vm);
+
+/* Function mmio_attach makes bytes reg to reg + size - 1 a device register with callbacks
+ * read and write, either of which may be NULL. Returns 0 if they overlap another register
+ * or lie outside the MMIO page. */
+int mmio_attach(struct vm *vm, uint16_t reg, unsigned size, mmio_callback read, mmio_callback write);
+
+/* Function mmio_set stores byte value in device register byte addr, from the device side. */
+void mmio_set(struct vm *vm, uint16_t addr, uint8_t value);
+
+/* Function mmio_dispatch_read calls the read callbacks of the registers the word at addr straddles. */
+void mmio_dispatch_read(struct vm *vm, uint16_t addr);
+
+/* Function mmio_dispatch_write calls the write callbacks of the registers the word at addr straddles. */
+void mmio_dispatch_write(struct vm *vm, uint16_t addr);
+
+/* Function mmio_touches checks if the word at address addr has a byte in the MMIO page. */
+static inline int mmio_touches(uint16_t addr)
+{
+    return addr >= MMIO_BASE - 1;
+}
+
+/* Function mmio_read must be called before the CPU reads the word at address addr. */
+static inline void mmio_read(struct vm *vm, uint16_t addr)
+{
+    if (mmio_touches(addr))
+        mmio_dispatch_read(vm, addr);
+}
+
+/* Function mmio_write must be called after the CPU wrote the word at address addr. */
+static inline void mmio_write(struct vm *vm, uint16_t addr)
+{
+    if (mmio_touches(addr))
+        mmio_dispatch_write(vm, addr);
+}
+
+#endif /* MMIO_H */
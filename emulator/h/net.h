@@ -0,0 +1,95 @@
+/* File: net.h */
+/* Packet device. */
+
+#ifndef NET_H
+#define NET_H
+
+#include <stdint.h>
+
+#include "vm.h"
+
+/* Device registers, one word each. */
+#define NET_TX_RING_REGISTER ((uint16_t) 0xff90)   /* address of the transmit ring */
+#define NET_RX_RING_REGISTER ((uint16_t) 0xff92)   /* address of the receive ring */
+#define NET_RING_SIZE_REGISTER ((uint16_t) 0xff94) /* number of descriptors of each ring */
+#define NET_TX_HEAD_REGISTER ((uint16_t) 0xff96)   /* next descriptor to send, read only */
+#define NET_TX_TAIL_REGISTER ((uint16_t) 0xff98)   /* first descriptor not ready to send */
+#define NET_RX_HEAD_REGISTER ((uint16_t) 0xff9a)   /* next descriptor to fill, read only */
+#define NET_RX_TAIL_REGISTER ((uint16_t) 0xff9c)   /* first descriptor not ready to fill */
+#define NET_COALESCE_PACKETS_REGISTER ((uint16_t) 0xff9e) /* packets per receive interrupt */
+#define NET_COALESCE_DELAY_REGISTER ((uint16_t) 0xffa0)   /* longest wait for one, 0 for none */
+#define NET_STATUS_REGISTER ((uint16_t) 0xffa2)    /* NET_* flags, read only */
+
+/* Status flags. */
+#define NET_RX_EOF 0x0001 /* the packet file has been read to the end */
+
+/* Size of a descriptor: buffer address word and length word. */
+#define NET_DESCRIPTOR_SIZE 4
+
+/* Number of retired instructions between two polls of the receive side. */
+#define NET_POLL_INTERVAL 1024
+
+/* Largest packet the device reads from its host backend. */
+#define NET_MAX_PACKET 65535
+
+/* First bytes of a packet file: a pcap file with link type LINKTYPE_USER0. */
+#define NET_PCAP_MAGIC 0xa1b2c3d4u
+#define NET_PCAP_LINKTYPE 147
+
+/* With options.net_in_filename, options.net_out_filename or options.net_socket
+ * set, the machine has a packet device. It receives packets from the records of
+ * a pcap file, or from a Unix datagram socket bound at the given path, and sends
+ * them to another pcap file, stamped with the number of retired instructions as
+ * microseconds, or over the socket to the sender of the last packet received. The
+ * socket never blocks the CPU: a packet the peer has no room for is dropped.
+ *
+ * Both rings are arrays of NET_RING_SIZE_REGISTER descriptors in guest memory,
+ * used in order and wrapping around. Each descriptor is the address of a buffer
+ * and its length. A ring holds the descriptors from its head up to, but not
+ * including, its tail; one descriptor always stays outside, so both being equal
+ * means the ring is empty.
+ *
+ * To send, the guest fills in the descriptors at the transmit tail and advances
+ * the tail register. Writing it sends every packet of the ring at once and
+ * advances the head register past them, so the buffers are free again.
+ *
+ * To receive, the guest sets the length of each descriptor to the size of its
+ * buffer and advances the receive tail register past them. Every NET_POLL_INTERVAL
+ * instructions the device fills in as many of them as it has packets for, at the
+ * receive head: it copies each packet into the buffer, truncated to its length,
+ * sets the length of the descriptor to that of the copy and advances the head
+ * register. The guest processes the descriptors up to the head and hands each
+ * back by moving the tail onto it.
+ *
+ * The receive interrupt at NET_DEVICE_IVTENTRY is raised once the device received
+ * NET_COALESCE_PACKETS_REGISTER packets since the last one (0 counts as 1), or the
+ * first of them has waited NET_COALESCE_DELAY_REGISTER instructions, checked at
+ * polls, or the end of the packet file is reached, and as soon as the CPU can take
+ * it. There is no transmit interrupt.
+ *
+ * Packet files make runs reproducible; packets from the socket are not part of an
+ * event log. A machine restored from a snapshot reads its packet file from the start.
+ *
+ * A ring that doesn't fit below the MMIO page, or holds less than two descriptors,
+ * moves no packets. A buffer is cut short at the MMIO page. */
+
+/* Function init_net_device opens the host backend of the packet device of vm and
+ * attaches its registers, if its options ask for one. Returns 0 on failure. */
+int init_net_device(struct vm *vm);
+
+/* Function close_net_device closes the host backend of vm and logs its counters. */
+void close_net_device(struct vm *vm);
+
+/* Function net_pending checks if vm can receive a packet from its file or has
+ * a receive interrupt due, so the CPU must not sleep. */
+int net_pending(struct vm *vm);
+
+/* Function net_socket returns the socket of vm, for an idle CPU to wait on,
+ * -1 if it has none. */
+int net_socket(struct vm *vm);
+
+/* Function restart_net_device schedules the packet device again after the state
+ * of vm was replaced by a snapshot. */
+void restart_net_device(struct vm *vm);
+
+#endif /* NET_H */
@@ -159,5 +159,34 @@ int write_section(const unsigned char *content, uint32_t size, FILE *fp, FILE *t
 /* Function read_section reads section content from a given binary file into a given buffer. */
 int read_section(unsigned char *buffer, uint32_t size, FILE *fp);
 
+/* Flat Executable */
+
+/* A flat executable holds a FlatHeader, the whole memory image at FLAT_IMAGE_OFFSET
+ * and, if sym_cnt is not 0, sym_cnt FlatSymbol entries sorted by value at symtab_offset. */
+
+#define FLAT_MAGIC "RFLT"
+
+#define FLAT_VERSION 1
+
+#define FLAT_IMAGE_SIZE (UINT16_MAX + 1)
+
+#define FLAT_IMAGE_OFFSET 4096 /* page aligned, so the image can be mapped directly */
+
+#define FLAT_PAGE_SIZE 256 /* memory covered by one bit of the segment map */
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t entry;         /* value of START */
+    uint32_t symtab_offset; /* 0 if there are no symbols */
+    uint32_t sym_cnt;
+    uint8_t segment_map[FLAT_IMAGE_SIZE / FLAT_PAGE_SIZE / 8]; /* bit set for pages holding segments */
+} FlatHeader;
+
+typedef struct {
+    uint16_t sym_val;
+    char sym_name[SYMBOL_MAXLEN + 1];
+} FlatSymbol;
+
 #endif /* OBJ_FORMAT_H */
 
@@ -0,0 +1,44 @@
+/* File: profile.h */
+/* Execution profile: retired instructions per address. */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vm.h"
+#include "symbols.h"
+
+/* Counters of a machine run with options.profile set, indexed by the address of
+ * the first byte of an instruction. Engines update them inline: an instruction
+ * adds one to count when it retires, and a conditional instruction whose condition
+ * doesn't hold also adds one to not_taken. */
+struct profile {
+    uint64_t count[MEM_SIZE];
+    uint64_t not_taken[MEM_SIZE];
+};
+
+/* Function init_profile allocates the counters of vm if its options ask for them.
+ * Returns 0 on failure. */
+int init_profile(struct vm *vm);
+
+/* Function close_profile frees the counters of vm. */
+void close_profile(struct vm *vm);
+
+/* Function write_profile writes the hot-spot report of vm to file filename: the counters
+ * summed per nearest preceding symbol of executable file bin (NULL if there is none),
+ * then per address, both sorted by count. Returns 0 on failure. */
+int write_profile(struct vm *vm, FILE *bin, const char *filename);
+
+/* Function write_symbol_counts writes counters count, indexed by address, to fp summed
+ * per nearest preceding symbol of syms and sorted by count, under heading "by title". */
+void write_symbol_counts(FILE *fp, const char *title, const struct symbols *syms, const uint64_t *count);
+
+/* Function write_address_counts writes the nonzero counters count, indexed by address,
+ * to fp sorted by count. If not_taken isn't NULL, conditional instructions of vm also get
+ * the number of times their condition held and didn't hold. */
+void write_address_counts(FILE *fp, struct vm *vm, const struct symbols *syms,
+                          const uint64_t *count, const uint64_t *not_taken);
+
+#endif /* PROFILE_H */
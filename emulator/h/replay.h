@@ -0,0 +1,48 @@
+/* File: replay.h */
+/* Record and replay of device events. */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+
+#include "vm.h"
+
+/* First line of an event log. */
+#define REPLAY_HEADER "# emu event log v1"
+
+/* Device events. */
+enum {
+    REPLAY_INPUT = 0, /* byte delivered by the input device, with its input interrupt */
+    REPLAY_TIMER = 1, /* timer interrupt */
+    REPLAY_STOP = 2,  /* end of the recorded run */
+};
+
+/* A machine run with options.record_filename set writes every device event
+ * that reaches the CPU to an event log, one line per event: the number of
+ * instructions retired when it happened, its name and, for input, the byte,
+ *
+ *     1024 input 97
+ *     1000000 timer
+ *     1503817 stop
+ *
+ * A machine run with options.replay_filename set reads the whole log when it
+ * is created and raises the same events at the same instruction counts with
+ * the scheduler, instead of reading input and running the timer, so it retires
+ * the same instruction stream as the recorded run at full speed. The stop event
+ * stops it where the recorded run ended, like options.max_insns. The jit engine
+ * runs events between blocks, so a log is only replayed exactly by the engine
+ * it was recorded with. */
+
+/* Function init_replay opens the event log of vm if its options ask for one, and in
+ * replay mode reads it and schedules the first event. Returns 0 on failure. */
+int init_replay(struct vm *vm);
+
+/* Function close_replay records the stop event, if vm records, and closes its event log. */
+void close_replay(struct vm *vm);
+
+/* Function record_event writes event kind (REPLAY_*), with byte value for input, to the
+ * event log of vm at the current instruction count, unless vm replays. */
+void record_event(struct vm *vm, int kind, int value);
+
+#endif /* REPLAY_H */
@@ -0,0 +1,43 @@
+/* File: sampler.h */
+/* Statistical profile: guest PC sampled every so many instructions. */
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdio.h>
+
+#include "vm.h"
+
+/* Default number of retired instructions between two samples. A prime,
+ * so samples don't keep hitting the same instructions of a loop. */
+#define SAMPLER_DEFAULT_PERIOD 10007
+
+/* Number of samples the ring holds until the drain thread takes them. Must be a power of two. */
+#define SAMPLER_RING_SIZE 4096
+
+/* Milliseconds between two drains of the ring. */
+#define SAMPLER_DRAIN_INTERVAL 10
+
+/* A machine run with options.sample_period set takes a sample every sample_period
+ * instructions with a scheduler event, so the engines pay nothing in between.
+ * The event puts the PC, and the innermost routine of the shadow call stack
+ * if options.callgraph is set, into a ring without locks; a thread of the
+ * sampler drains the ring into per-address counts. Samples that find the ring
+ * full are dropped and counted. The jit engine takes samples at block boundaries. */
+
+/* Function init_sampler starts the drain thread of vm if its options ask for samples.
+ * Returns 0 on failure. */
+int init_sampler(struct vm *vm);
+
+/* Function close_sampler stops the drain thread of vm and frees the sampler. */
+void close_sampler(struct vm *vm);
+
+/* Function sampler_start schedules the next sample of vm. */
+void sampler_start(struct vm *vm);
+
+/* Function write_samples writes the samples of vm to file filename, summed per nearest
+ * preceding symbol of executable file bin (NULL if there is none), per address and per
+ * routine on the shadow call stack, each sorted by count. Returns 0 on failure. */
+int write_samples(struct vm *vm, FILE *bin, const char *filename);
+
+#endif /* SAMPLER_H */
@@ -0,0 +1,42 @@
+/* File: sched.h */
+/* Device event scheduler. */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+#include "vm.h"
+
+/* Maximum number of simultaneously scheduled events. */
+#define SCHED_MAX_EVENTS 32
+
+/* vm->sched_next is the value of vm->retired at which the earliest
+ * scheduled event is due, UINT64_MAX if there is none. */
+
+/* Function init_sched creates the event queue of vm. Returns 0 on failure. */
+int init_sched(struct vm *vm);
+
+/* Function close_sched frees the event queue of vm. */
+void close_sched(struct vm *vm);
+
+/* Function sched_at schedules callback to be called once vm->retired reaches deadline.
+ * Periodic devices call it again from their callback. If SCHED_MAX_EVENTS events are
+ * already scheduled, it halts the CPU of vm, sets vm->failed and returns 0, so only
+ * that machine stops, whichever device overflowed the queue. */
+int sched_at(struct vm *vm, uint64_t deadline, void (*callback)(struct vm *));
+
+/* Function sched_clear drops all scheduled events. */
+void sched_clear(struct vm *vm);
+
+/* Function sched_run calls the callbacks of all events that are due. */
+void sched_run(struct vm *vm);
+
+/* Function sched_poll must be called by the CPU after each retired instruction. */
+static inline void sched_poll(struct vm *vm)
+{
+    if (vm->retired >= vm->sched_next)
+        sched_run(vm);
+}
+
+#endif /* SCHED_H */
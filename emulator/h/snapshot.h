@@ -0,0 +1,34 @@
+/* File: snapshot.h */
+/* Machine snapshots. */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "vm.h"
+
+#define SNAPSHOT_MAGIC "EMUSNAP"
+#define SNAPSHOT_VERSION 1
+
+/* Offset of the memory image in a snapshot file. It is page aligned,
+ * so the image can be mapped directly into a machine. */
+#define SNAPSHOT_MEM_OFFSET 4096
+
+/* A snapshot file holds a header with the CPU registers, the interrupt state,
+ * the retired instruction count and the timer state, followed by the memory
+ * image at SNAPSHOT_MEM_OFFSET. Console buffers are not part of it: output is
+ * flushed before saving, and a restored machine reads its own input. */
+
+/* Function save_snapshot writes the state of vm to file filename. Returns 0 on failure. */
+int save_snapshot(struct vm *vm, const char *filename);
+
+/* Function restore_snapshot replaces the state of vm, which must not have run yet,
+ * with the snapshot in file filename. The memory image is mapped copy-on-write,
+ * so machines restored from the same file share its pages until they write them.
+ * The timer settings of vm are replaced by those of the snapshot.
+ * Returns 0 on failure. */
+int restore_snapshot(struct vm *vm, const char *filename);
+
+/* Function is_snapshot checks if file filename starts like a snapshot. */
+int is_snapshot(const char *filename);
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,41 @@
+/* File: symbols.h */
+/* Symbols of a loaded executable, for reports. */
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "obj_format.h"
+
+struct symbol {
+    uint16_t value;
+    uint8_t section; /* segment symbol, see find_nearest_symbol */
+    char name[SYMBOL_MAXLEN + 1];
+};
+
+/* Symbols sorted by value. */
+struct symbols {
+    struct symbol *sym;
+    uint32_t count;
+};
+
+/* Function load_symbols reads the symbols of executable file bin, either format,
+ * into syms. An executable without symbols, or a NULL bin, gives an empty table.
+ * The file position of bin is not preserved. */
+void load_symbols(struct symbols *syms, FILE *bin);
+
+/* Function free_symbols frees the symbols read by load_symbols. */
+void free_symbols(struct symbols *syms);
+
+/* Function find_nearest_symbol returns the symbol with the greatest value not above addr,
+ * or NULL if there is none. Of symbols with the same value, a segment symbol is
+ * returned only if there is no other. */
+const struct symbol *find_nearest_symbol(const struct symbols *syms, uint16_t addr);
+
+/* Function format_address writes addr as "symbol+offset", or as a plain address
+ * if no symbol precedes it, into buffer buf of size bytes. */
+void format_address(const struct symbols *syms, uint16_t addr, char *buf, size_t size);
+
+#endif /* SYMBOLS_H */
@@ -0,0 +1,13 @@
+/* File: threaded.h */
+/* Threaded-code execution engine. */
+
+#ifndef THREADED_H
+#define THREADED_H
+
+#include "vm.h"
+
+/* Function run_threaded executes predecoded instructions until the CPU halts,
+ * jumping directly from one (opcode, destination kind) handler to the next. */
+void run_threaded(struct vm *vm);
+
+#endif /* THREADED_H */
@@ -0,0 +1,97 @@
+/* File: trace.h */
+/* Instruction trace: binary records of retired instructions in a mapped ring file. */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vm.h"
+#include "cpu.h"
+#include "alu.h"
+#include "icache.h"
+#include "obj_format.h"
+#include "trace_format.h"
+
+/* Default number of records in the ring, 24 MiB of file. */
+#define TRACE_DEFAULT_RECORDS (1 << 20)
+
+/* Maximum number of records in the ring, 24 GiB of file. */
+#define TRACE_MAX_RECORDS (1ULL << 30)
+
+/* A machine run with options.trace_filename set writes a record for every
+ * retired instruction that passes the filters into a ring of fixed-size
+ * records, mapped shared from the file, so the hot path only stores a few
+ * words and the kernel writes them back. The file is complete even if the
+ * emulator is killed. Tracing needs the state of every instruction, so it
+ * runs the interp engine whatever engine is selected. Records are decoded
+ * by the trace decoder, see decoder/. */
+struct trace {
+    TraceHeader *header;    /* mapping of the whole file */
+    TraceRecord *ring;
+    uint64_t capacity;
+    uint64_t next;          /* index of the next record */
+    size_t size;            /* of the mapping */
+
+    /* Filters: address range, inclusive, and retired instruction range, exclusive at the end. */
+    uint16_t pc_lo;
+    uint16_t pc_hi;
+    uint64_t from;
+    uint64_t to;
+};
+
+/* Function init_trace creates the trace file of vm if its options ask for one.
+ * Returns 0 on failure. */
+int init_trace(struct vm *vm);
+
+/* Function close_trace unmaps the trace file of vm and logs the number of records written. */
+void close_trace(struct vm *vm);
+
+/* Function trace_insn writes the record of the instruction at address pc, which vm has
+ * just executed, or found illegal, and not yet counted in vm->retired. Flag held tells if
+ * its condition held. */
+static inline void trace_insn(struct vm *vm, uint16_t pc, int held)
+{
+    struct trace *t = vm->trace;
+    if (pc < t->pc_lo || pc > t->pc_hi || vm->retired < t->from || vm->retired >= t->to)
+        return;
+
+    TraceRecord *r = &t->ring[t->next];
+    if (++t->next == t->capacity)
+        t->next = 0;
+
+    uint16_t flags = 0;
+    if (vm->fetched->len == INSTRUCTION_SIZE_LONG)
+        flags |= TRACE_LONG;
+    if (ILLEGAL_INSTRUCTION(vm))
+    {
+        flags |= TRACE_ILLEGAL;
+    }
+    else if (!held)
+    {
+        flags |= TRACE_NOT_TAKEN;
+    }
+    else if (vm->memory_write)
+    {
+        flags |= TRACE_WRITE;
+        r->write_addr = (uint16_t)((unsigned char *) vm->operand[0] - vm->mem);
+    }
+    else if (vm->fetched->opcode == PUSH || vm->fetched->opcode == CALL)
+    {
+        /* push() stores to the stack directly, the word written is at the new SP */
+        flags |= TRACE_WRITE;
+        r->write_addr = (uint16_t) vm->cpu_context.reg[6];
+    }
+
+    psw_sync(vm);
+    r->seq = vm->retired;
+    r->pc = pc;
+    r->ir0 = (uint16_t) vm->ir0;
+    r->ir1 = (uint16_t) vm->ir1;
+    r->psw = (uint16_t) vm->cpu_context.psw;
+    r->flags = flags;
+    ++t->header->written;
+}
+
+#endif /* TRACE_H */
@@ -0,0 +1,46 @@
+/* File: trace_format.h */
+/* Layout of the instruction trace file written by the emulator. */
+
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "ETFTRACE"
+
+#define TRACE_VERSION 1
+
+/* Offset of the first record, so the ring is page aligned in the file. */
+#define TRACE_RECORDS_OFFSET 4096
+
+/* Record flags. */
+#define TRACE_LONG      0x0001 /* ir1 is the second word of the instruction */
+#define TRACE_WRITE     0x0002 /* write_addr holds the address the instruction wrote to */
+#define TRACE_NOT_TAKEN 0x0004 /* the condition didn't hold, the instruction did nothing */
+#define TRACE_ILLEGAL   0x0008 /* ir0 isn't a valid instruction */
+
+/* The file starts with a header, followed at TRACE_RECORDS_OFFSET by a ring
+ * of capacity records. Record n of the trace is at index n % capacity, so
+ * once written exceeds capacity the ring holds the last capacity records,
+ * starting at index written % capacity. All fields are in host byte order. */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity;  /* records in the ring */
+    uint64_t written;   /* records written since the trace was created */
+} TraceHeader;
+
+/* One retired instruction. */
+typedef struct {
+    uint64_t seq;        /* instructions retired before this one */
+    uint16_t pc;         /* address of the instruction */
+    uint16_t ir0;
+    uint16_t ir1;        /* valid if TRACE_LONG is set */
+    uint16_t psw;        /* after the instruction */
+    uint16_t write_addr; /* valid if TRACE_WRITE is set */
+    uint16_t flags;      /* TRACE_* */
+    uint32_t reserved;
+} TraceRecord;
+
+#endif /* TRACE_FORMAT_H */
@@ -0,0 +1,153 @@
+/* File: vm.h */
+/* Emulated machine: CPU, memory and devices of one guest. */
+
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+#include "mem.h"
+
+struct icache_entry;
+struct mmio;
+struct sched;
+struct console;
+struct timer;
+struct block;
+struct net;
+struct jit;
+struct profile;
+struct callgraph;
+struct sampler;
+struct trace;
+struct replay;
+
+/* Settings a machine is created with. */
+struct vm_options {
+    int engine;            /* ENGINE_*, see control.h */
+    int timer_mode;        /* TIMER_*, see devices.h */
+    uint64_t timer_period; /* in units of timer_mode, 0 selects the default */
+    int input_fd;          /* console input, -1 for none */
+    int output_fd;         /* console output */
+    uint64_t max_insns;    /* stop after this many instructions retired by resume, 0 for no limit */
+    int profile;           /* count retired instructions per address, see profile.h */
+    int callgraph;         /* keep a shadow call stack, see callgraph.h */
+    uint64_t sample_period; /* sample the PC every this many instructions, 0 for never, see sampler.h */
+    const char *trace_filename; /* write a trace of retired instructions to this file, NULL for none, see trace.h */
+    uint64_t trace_records; /* records in the trace ring, 0 selects the default */
+    uint16_t trace_pc_lo;   /* trace only instructions at addresses from trace_pc_lo */
+    uint16_t trace_pc_hi;   /* to trace_pc_hi, inclusive */
+    uint64_t trace_from;    /* trace only instructions retired after trace_from others */
+    uint64_t trace_to;      /* and before trace_to others, 0 for no limit */
+    const char *record_filename; /* write device events to this event log, NULL for none, see replay.h */
+    const char *replay_filename; /* take device events from this event log instead, NULL for none */
+    const char *disk_filename;   /* back the block device with this file, NULL for none, see block.h */
+    const char *net_in_filename; /* receive packets from this pcap file, NULL for none, see net.h */
+    const char *net_out_filename; /* send packets to this pcap file, NULL for none */
+    const char *net_socket;      /* exchange packets over a datagram socket bound at this path instead */
+};
+
+/* Complete state of one emulated machine. Every part of the emulator
+ * operates on the machine it is passed, so any number of them can run
+ * in one process, each on its own thread. */
+struct vm {
+    struct cpu_context_t cpu_context;
+
+    /* Instruction registers. */
+    int16_t ir0;
+    int16_t ir1;
+
+    /* Memory address register. */
+    uint16_t mar;
+
+    /* Operand addresses. */
+    int16_t *operand[2];
+
+    /* Interrupt Vector Table Pointer. */
+    int16_t ivtp;
+    int16_t ivtentry;
+
+    /* Interrupt request, see intr.h. */
+    int intr;
+
+    /* Flag indicating if memory address is decoded as destination. */
+    int memory_dst;
+
+    /* Flag indicating if explicit write to memory was performed.
+     * Push to stack isn't considered as explicit write to memory. */
+    int memory_write;
+
+    /* Predecoded cache entry of the most recently fetched instruction. */
+    struct icache_entry *fetched;
+
+    /* Number of instructions retired since reset. */
+    uint64_t retired;
+
+    /* Flag indicating if the run was stopped after options.max_insns instructions. */
+    int out_of_budget;
+
+    /* Flag indicating if the run was stopped by an emulator error, see sched.h. */
+    int failed;
+
+    /* MEM_SIZE bytes of private memory mapping, see snapshot.h, and a guard page, see mem.h. */
+    unsigned char *mem;
+
+    /* Predecoded instruction cache, see icache.h. */
+    struct icache_entry *icache;
+    uint8_t *icache_code_map;
+    unsigned icache_generation;
+    int icache_fusion;
+
+    /* Last branch checked for an idle loop, see idle.h. */
+    uint16_t idle_pc;
+    unsigned idle_generation;
+    int idle_insns;
+    uint64_t idle_retired;
+
+    /* Device registers, see mmio.h. */
+    struct mmio *mmio;
+
+    /* Device event scheduler, see sched.h. */
+    uint64_t sched_next;
+    struct sched *sched;
+
+    /* Devices, see devices.h. */
+    struct console *console;
+    struct timer *timer;
+
+    /* Block device, NULL unless options.disk_filename is set, see block.h. */
+    struct block *block;
+
+    /* Packet device, NULL unless a packet file or socket is set in options, see net.h. */
+    struct net *net;
+
+    struct vm_options options;
+
+    /* Translated code of the jit engine, created on first use. */
+    struct jit *jit;
+
+    /* Execution profile, NULL unless options.profile is set. */
+    struct profile *profile;
+
+    /* Shadow call stack, NULL unless options.callgraph is set. */
+    struct callgraph *callgraph;
+
+    /* Statistical profile, NULL unless options.sample_period is set. */
+    struct sampler *sampler;
+
+    /* Instruction trace, NULL unless options.trace_filename is set. */
+    struct trace *trace;
+
+    /* Device event log, NULL unless options.record_filename or options.replay_filename is set. */
+    struct replay *replay;
+};
+
+/* Function vm_create creates a machine with zeroed memory and initialized devices.
+ * Returns NULL if memory for it can't be allocated. */
+struct vm *vm_create(const struct vm_options *options);
+
+/* Function vm_destroy stops the devices of vm, flushes its output and frees it. */
+void vm_destroy(struct vm *vm);
+
+#endif /* VM_H */
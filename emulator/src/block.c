@@ -0,0 +1,229 @@
+/* File: block.c */
+/* Block storage device. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Note: non-standard headers, available on POSIX systems */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "vm.h"
+#include "icache.h"
+#include "mmio.h"
+#include "sched.h"
+#include "block.h"
+
+/* Largest addressable disk. */
+#define BLOCK_MAX_SIZE ((size_t) (UINT16_MAX + 1) * BLOCK_SECTOR_SIZE)
+
+/* Disk state. */
+struct block {
+    uint8_t *disk;         /* mapping of the disk file */
+    size_t size;           /* in bytes, a whole number of sectors */
+    int writable;
+
+    uint8_t status;        /* BLOCK_*, mirrored by the status register */
+    uint64_t done_at;      /* vm->retired when a busy command completes */
+    int irq;               /* the completion interrupt is waiting for the CPU */
+    int scheduled;         /* block_event is scheduled */
+
+    /* Command latched when it was written. */
+    int command;
+    uint16_t sector;
+    uint16_t address;
+    uint16_t count;
+};
+
+static uint16_t read_register(struct vm *vm, uint16_t reg)
+{
+    return (uint16_t)(vm->mem[reg] | vm->mem[reg + 1] << 8);
+}
+
+static void set_status(struct vm *vm, uint8_t status)
+{
+    vm->block->status = status;
+    mmio_set(vm, BLOCK_STATUS_REGISTER, status);
+    mmio_set(vm, BLOCK_STATUS_REGISTER + 1, 0);
+}
+
+static void block_event(struct vm *vm);
+
+/* Function schedule makes block_event run at deadline, unless it already runs earlier. */
+static void schedule(struct vm *vm, uint64_t deadline)
+{
+    struct block *b = vm->block;
+    if (b->scheduled)
+        return;
+    b->scheduled = 1;
+    sched_at(vm, deadline, block_event);
+}
+
+/* Function transfer copies the latched command between the disk and memory.
+ * Returns the new status. */
+static uint8_t transfer(struct vm *vm)
+{
+    struct block *b = vm->block;
+    size_t offset = (size_t) b->sector * BLOCK_SECTOR_SIZE;
+    size_t len = (size_t) b->count * BLOCK_SECTOR_SIZE;
+
+    if ((b->command != BLOCK_READ && b->command != BLOCK_WRITE)
+        || (b->command == BLOCK_WRITE && !b->writable)
+        || offset + len > b->size || (size_t) b->address + len > MMIO_BASE)
+        return BLOCK_ERROR;
+
+    if (b->command == BLOCK_WRITE)
+    {
+        memcpy(b->disk + offset, vm->mem + b->address, len);
+        return BLOCK_READY;
+    }
+
+    memcpy(vm->mem + b->address, b->disk + offset, len);
+    size_t i;
+    for (i = 0; i < len; i += 2)
+        icache_write(vm, (uint16_t)(b->address + i));
+    return BLOCK_READY;
+}
+
+/* Function block_event completes a busy command when it is due and raises the completion
+ * interrupt once the CPU can take it, without overwriting another one. */
+static void block_event(struct vm *vm)
+{
+    struct block *b = vm->block;
+    b->scheduled = 0;
+
+    if (b->status == BLOCK_BUSY && vm->retired >= b->done_at)
+    {
+        set_status(vm, transfer(vm));
+        b->irq = 1;
+    }
+
+    if (b->irq && !vm->intr && !PSW_TEST_FLAG(vm, PSW_FLAG_I))
+    {
+        b->irq = 0;
+        vm->intr = 1;
+        vm->ivtentry = BLOCK_DEVICE_IVTENTRY;
+    }
+
+    if (b->irq)
+        schedule(vm, vm->retired + BLOCK_RETRY_INTERVAL);
+    else if (b->status == BLOCK_BUSY)
+        schedule(vm, b->done_at);
+}
+
+/* Function start latches the command in the registers and starts it. */
+static void start(struct vm *vm)
+{
+    struct block *b = vm->block;
+    b->command = read_register(vm, BLOCK_COMMAND_REGISTER);
+    b->sector = read_register(vm, BLOCK_SECTOR_REGISTER);
+    b->address = read_register(vm, BLOCK_ADDRESS_REGISTER);
+    b->count = read_register(vm, BLOCK_COUNT_REGISTER);
+    b->done_at = vm->retired + BLOCK_LATENCY;
+    set_status(vm, BLOCK_BUSY);
+    schedule(vm, b->done_at);
+}
+
+static void command_register_write(struct vm *vm, uint16_t reg)
+{
+    (void) reg;
+    if (vm->block->status != BLOCK_BUSY)
+        start(vm);
+}
+
+static void status_register_write(struct vm *vm, uint16_t reg)
+{
+    (void) reg;
+    set_status(vm, vm->block->status);
+}
+
+/* Function map_disk opens and maps the disk file filename. Returns 0 on failure. */
+static int map_disk(struct block *b, const char *filename)
+{
+    int fd = open(filename, O_RDWR);
+    b->writable = fd >= 0;
+    if (fd < 0)
+        fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        write_log(LOG_ERROR, "block: failed to open disk '%s'", filename);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < BLOCK_SECTOR_SIZE)
+    {
+        write_log(LOG_ERROR, "block: disk '%s' is smaller than a sector", filename);
+        close(fd);
+        return 0;
+    }
+    b->size = (size_t) st.st_size / BLOCK_SECTOR_SIZE * BLOCK_SECTOR_SIZE;
+    if (b->size > BLOCK_MAX_SIZE)
+        b->size = BLOCK_MAX_SIZE;
+
+    void *disk = mmap(NULL, b->size, b->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (disk == MAP_FAILED)
+    {
+        write_log(LOG_ERROR, "block: failed to map disk '%s'", filename);
+        return 0;
+    }
+    b->disk = disk;
+    write_log(LOG_NORMAL, "block: disk '%s', %zu sectors%s", filename,
+              b->size / BLOCK_SECTOR_SIZE, b->writable ? "" : ", read-only");
+    return 1;
+}
+
+int init_block_device(struct vm *vm)
+{
+    if (!vm->options.disk_filename)
+        return 1;
+
+    struct block *b = vm->block = calloc(1, sizeof(struct block));
+    if (!b)
+        return 0;
+    if (!map_disk(b, vm->options.disk_filename))
+        return 0;
+
+    return mmio_attach(vm, BLOCK_SECTOR_REGISTER, 2, NULL, NULL)
+        && mmio_attach(vm, BLOCK_ADDRESS_REGISTER, 2, NULL, NULL)
+        && mmio_attach(vm, BLOCK_COUNT_REGISTER, 2, NULL, NULL)
+        && mmio_attach(vm, BLOCK_COMMAND_REGISTER, 2, NULL, command_register_write)
+        && mmio_attach(vm, BLOCK_STATUS_REGISTER, 2, NULL, status_register_write);
+}
+
+void close_block_device(struct vm *vm)
+{
+    struct block *b = vm->block;
+    if (!b)
+        return;
+    if (b->disk)
+        munmap(b->disk, b->size);
+    free(b);
+    vm->block = NULL;
+}
+
+int block_pending(struct vm *vm)
+{
+    struct block *b = vm->block;
+    return b && (b->status == BLOCK_BUSY || b->irq);
+}
+
+void restart_block_device(struct vm *vm)
+{
+    struct block *b = vm->block;
+    if (!b)
+        return;
+
+    b->scheduled = 0;
+    b->irq = 0;
+    b->status = vm->mem[BLOCK_STATUS_REGISTER];
+    if (b->status == BLOCK_BUSY)
+        start(vm);
+}
@@ -0,0 +1,476 @@
+/* File: callgraph.c */
+/* Function-level profile: shadow call stack of the guest. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "vm.h"
+#include "symbols.h"
+#include "callgraph.h"
+
+/* Call path: a frame named after address addr, called from the path of its parent.
+ * Node 0 is the root above the outermost frame and the interrupt nodes. */
+struct node {
+    uint32_t parent;
+    uint32_t child;     /* first callee */
+    uint32_t sibling;   /* next callee of the parent */
+    uint16_t addr;      /* called address, or IVT entry of an interrupt node */
+    uint16_t intr;      /* nonzero for interrupt nodes */
+    uint64_t self;      /* instructions retired while this was the innermost path */
+    uint64_t calls;
+};
+
+struct frame {
+    uint32_t node;
+    uint16_t ret;       /* return address */
+    uint16_t sp;        /* stack pointer after the return address was pushed */
+    int intr;
+};
+
+struct callgraph {
+    struct node *nodes;
+    uint32_t nnodes;
+    uint32_t capacity;
+    struct frame frames[CALLGRAPH_MAX_DEPTH];
+    uint32_t depth;
+    uint64_t charged;   /* retired count up to which instructions are charged */
+    int truncated;
+};
+
+int init_callgraph(struct vm *vm)
+{
+    if (!vm->options.callgraph)
+        return 1;
+
+    struct callgraph *cg = calloc(1, sizeof(struct callgraph));
+    if (!cg)
+    {
+        write_log(LOG_ERROR, "callgraph: failed to allocate the call stack");
+        return 0;
+    }
+    cg->capacity = 1024;
+    cg->nodes = calloc(cg->capacity, sizeof(struct node));
+    if (!cg->nodes)
+    {
+        write_log(LOG_ERROR, "callgraph: failed to allocate the call stack");
+        free(cg);
+        return 0;
+    }
+    cg->nnodes = 1;
+    vm->callgraph = cg;
+    return 1;
+}
+
+void close_callgraph(struct vm *vm)
+{
+    if (!vm->callgraph)
+        return;
+    free(vm->callgraph->nodes);
+    free(vm->callgraph);
+    vm->callgraph = NULL;
+}
+
+/* Function charge charges the instructions retired until now to the innermost path. */
+static void charge(struct callgraph *cg, uint64_t now)
+{
+    cg->nodes[cg->depth ? cg->frames[cg->depth - 1].node : 0].self += now - cg->charged;
+    cg->charged = now;
+}
+
+static void truncated(struct callgraph *cg, const char *what)
+{
+    if (!cg->truncated)
+        write_log(LOG_NORMAL, "callgraph: too many %s, the profile is truncated", what);
+    cg->truncated = 1;
+}
+
+/* Function find_node returns the callee of path parent named by addr and intr,
+ * adding it if it is new. */
+static uint32_t find_node(struct callgraph *cg, uint32_t parent, uint16_t addr, int intr)
+{
+    uint32_t n;
+    for (n = cg->nodes[parent].child; n; n = cg->nodes[n].sibling)
+        if (cg->nodes[n].addr == addr && cg->nodes[n].intr == intr)
+            return n;
+
+    if (cg->nnodes == cg->capacity)
+    {
+        struct node *nodes = NULL;
+        if (cg->capacity < CALLGRAPH_MAX_NODES)
+            nodes = realloc(cg->nodes, 2 * cg->capacity * sizeof(struct node));
+        if (!nodes)
+        {
+            truncated(cg, "call paths");
+            return parent;
+        }
+        cg->nodes = nodes;
+        cg->capacity *= 2;
+    }
+
+    n = cg->nnodes++;
+    memset(&cg->nodes[n], 0, sizeof(struct node));
+    cg->nodes[n].parent = parent;
+    cg->nodes[n].sibling = cg->nodes[parent].child;
+    cg->nodes[n].addr = addr;
+    cg->nodes[n].intr = (uint16_t) intr;
+    cg->nodes[parent].child = n;
+    return n;
+}
+
+static void push_frame(struct callgraph *cg, uint32_t node, uint16_t ret, uint16_t sp, int intr)
+{
+    ++cg->nodes[node].calls;
+    if (cg->depth == CALLGRAPH_MAX_DEPTH)
+    {
+        truncated(cg, "nested calls");
+        return;
+    }
+    struct frame *f = &cg->frames[cg->depth++];
+    f->node = node;
+    f->ret = ret;
+    f->sp = sp;
+    f->intr = intr;
+}
+
+/* Function stack_word returns the word at offset off from the stack pointer of vm. */
+static uint16_t stack_word(struct vm *vm, int off)
+{
+    uint16_t sp = (uint16_t)(vm->cpu_context.reg[6] + off);
+    return (uint16_t)(vm->mem[sp] | vm->mem[(uint16_t)(sp + 1)] << 8);
+}
+
+void callgraph_start(struct vm *vm)
+{
+    struct callgraph *cg = vm->callgraph;
+    if (cg->depth)
+        return;
+    cg->charged = vm->retired;
+    push_frame(cg, find_node(cg, 0, (uint16_t) vm->cpu_context.reg[7], 0), 0, 0, 0);
+}
+
+void callgraph_call(struct vm *vm)
+{
+    struct callgraph *cg = vm->callgraph;
+    charge(cg, vm->retired + 1);
+    uint32_t caller = cg->depth ? cg->frames[cg->depth - 1].node : 0;
+    push_frame(cg, find_node(cg, caller, (uint16_t) vm->cpu_context.reg[7], 0),
+               stack_word(vm, 0), (uint16_t) vm->cpu_context.reg[6], 0);
+}
+
+void callgraph_return(struct vm *vm)
+{
+    struct callgraph *cg = vm->callgraph;
+    uint16_t ret = (uint16_t) vm->cpu_context.reg[7];
+    uint16_t sp = (uint16_t)(vm->cpu_context.reg[6] - 2);
+
+    /* frames above the match were left without returning; a RET matching no frame is a jump,
+     * and the outermost frame is never left */
+    uint32_t i = cg->depth;
+    while (i > 1 && !cg->frames[i - 1].intr)
+    {
+        --i;
+        if (cg->frames[i].ret == ret && cg->frames[i].sp == sp)
+        {
+            charge(cg, vm->retired + 1);
+            cg->depth = i;
+            return;
+        }
+    }
+}
+
+void callgraph_iret(struct vm *vm)
+{
+    struct callgraph *cg = vm->callgraph;
+    uint32_t i = cg->depth;
+    while (i > 0)
+    {
+        if (cg->frames[--i].intr)
+        {
+            charge(cg, vm->retired + 1);
+            cg->depth = i;
+            return;
+        }
+    }
+}
+
+void callgraph_interrupt(struct vm *vm)
+{
+    struct callgraph *cg = vm->callgraph;
+    charge(cg, vm->retired);
+    uint32_t root = find_node(cg, 0, (uint16_t) vm->ivtentry, 1);
+    ++cg->nodes[root].calls;
+    push_frame(cg, find_node(cg, root, (uint16_t) vm->cpu_context.reg[7], 0),
+               stack_word(vm, 2), (uint16_t) vm->cpu_context.reg[6], 1);
+}
+
+uint16_t callgraph_top(struct vm *vm)
+{
+    struct callgraph *cg = vm->callgraph;
+    return cg->depth ? cg->nodes[cg->frames[cg->depth - 1].node].addr : 0;
+}
+
+/* Report. Paths are merged by symbol name first, as calls to different addresses
+ * of one routine are the same frame to the reader. Names are numbered: symbols
+ * by index, then addresses without a symbol, then IVT entries. */
+
+struct merged {
+    uint32_t name;
+    uint32_t parent;
+    uint32_t child;
+    uint32_t sibling;
+    uint64_t self;
+    uint64_t total;     /* self and callees */
+    uint64_t calls;
+};
+
+static uint32_t node_name(const struct symbols *syms, const struct node *n)
+{
+    if (n->intr)
+        return syms->count + MEM_SIZE + n->addr;
+    const struct symbol *sym = find_nearest_symbol(syms, n->addr);
+    return sym ? (uint32_t)(sym - syms->sym) : syms->count + n->addr;
+}
+
+static void format_name(const struct symbols *syms, uint32_t name, char *buf, size_t size)
+{
+    if (name < syms->count)
+        snprintf(buf, size, "%s", syms->sym[name].name);
+    else if (name < syms->count + MEM_SIZE)
+        snprintf(buf, size, "%#06x", name - syms->count);
+    else
+        snprintf(buf, size, "[interrupt %u]", name - syms->count - MEM_SIZE);
+}
+
+/* Function merge_paths merges the paths of cg with the same names. Returns their number. */
+static uint32_t merge_paths(const struct callgraph *cg, const struct symbols *syms, struct merged *m)
+{
+    uint32_t *map = malloc(cg->nnodes * sizeof(uint32_t));
+    if (!map)
+        return 0;
+
+    memset(&m[0], 0, sizeof(struct merged));
+    map[0] = 0;
+    uint32_t i, n, count = 1;
+    /* a parent always comes before its callees */
+    for (i = 1; i < cg->nnodes; ++i)
+    {
+        uint32_t parent = map[cg->nodes[i].parent];
+        uint32_t name = node_name(syms, &cg->nodes[i]);
+        for (n = m[parent].child; n && m[n].name != name; n = m[n].sibling)
+            ;
+        if (!n)
+        {
+            n = count++;
+            memset(&m[n], 0, sizeof(struct merged));
+            m[n].name = name;
+            m[n].parent = parent;
+            m[n].sibling = m[parent].child;
+            m[parent].child = n;
+        }
+        map[i] = n;
+        m[n].self += cg->nodes[i].self;
+        m[n].calls += cg->nodes[i].calls;
+    }
+    free(map);
+
+    for (i = count - 1; i > 0; --i)
+    {
+        m[i].total += m[i].self;
+        m[m[i].parent].total += m[i].total;
+    }
+    return count;
+}
+
+struct symbol_count {
+    uint32_t name;
+    uint64_t inclusive;
+    uint64_t exclusive;
+    uint64_t calls;
+};
+
+static int compare_counts(const void *a, const void *b)
+{
+    const struct symbol_count *x = a;
+    const struct symbol_count *y = b;
+    if (x->inclusive != y->inclusive)
+        return x->inclusive > y->inclusive ? -1 : 1;
+    if (x->exclusive != y->exclusive)
+        return x->exclusive > y->exclusive ? -1 : 1;
+    return x->name < y->name ? -1 : x->name > y->name;
+}
+
+/* Macro NEXT_PATH advances n to the next path in depth-first order, or to 0 at the end,
+ * evaluating leave for every path it is done with. */
+#define NEXT_PATH(m, n, leave)                      \
+    do {                                            \
+        if (m[n].child)                             \
+        {                                           \
+            n = m[n].child;                         \
+            break;                                  \
+        }                                           \
+        while (n && !m[n].sibling)                  \
+        {                                           \
+            leave;                                  \
+            n = m[n].parent;                        \
+        }                                           \
+        if (n)                                      \
+        {                                           \
+            leave;                                  \
+            n = m[n].sibling;                       \
+        }                                           \
+    } while (0)
+
+static int write_report(const struct merged *m, const struct symbols *syms, const char *filename)
+{
+    uint32_t nnames = syms->count + MEM_SIZE + 8;
+    struct symbol_count *counts = calloc(nnames, sizeof(struct symbol_count));
+    uint32_t *on_path = calloc(nnames, sizeof(uint32_t));
+    FILE *fp = NULL;
+    int ok = 0;
+    if (!counts || !on_path)
+    {
+        write_log(LOG_ERROR, "callgraph: out of memory");
+        goto done;
+    }
+
+    /* a recursive call is part of the inclusive count of its outermost frame only */
+    uint32_t i, n = m[0].child;
+    while (n)
+    {
+        struct symbol_count *c = &counts[m[n].name];
+        if (on_path[m[n].name]++ == 0)
+            c->inclusive += m[n].total;
+        c->exclusive += m[n].self;
+        c->calls += m[n].calls;
+        NEXT_PATH(m, n, --on_path[m[n].name]);
+    }
+    for (i = 0; i < nnames; ++i)
+        counts[i].name = i;
+    qsort(counts, nnames, sizeof(struct symbol_count), compare_counts);
+
+    fp = fopen(filename, "w");
+    if (!fp)
+    {
+        write_log(LOG_ERROR, "callgraph: failed to open file '%s'", filename);
+        goto done;
+    }
+
+    uint64_t total = m[0].total;
+    fprintf(fp, "# %llu instructions retired\n"
+                "#%19s %8s %20s %8s %12s  %s\n", (unsigned long long) total,
+                "inclusive", "%", "exclusive", "%", "calls", "symbol");
+    char name[SYMBOL_MAXLEN + 16];
+    for (i = 0; i < nnames && counts[i].inclusive; ++i)
+    {
+        format_name(syms, counts[i].name, name, sizeof(name));
+        fprintf(fp, "%20llu %7.2f%% %20llu %7.2f%% %12llu  %s\n",
+                (unsigned long long) counts[i].inclusive, 100.0 * counts[i].inclusive / total,
+                (unsigned long long) counts[i].exclusive, 100.0 * counts[i].exclusive / total,
+                (unsigned long long) counts[i].calls, name);
+    }
+    ok = 1;
+
+done:
+    if (fp && fclose(fp) != 0)
+    {
+        write_log(LOG_ERROR, "callgraph: failed to write file '%s'", filename);
+        ok = 0;
+    }
+    free(on_path);
+    free(counts);
+    return ok;
+}
+
+static int write_folded(const struct merged *m, uint32_t count, const struct symbols *syms,
+                        const char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+    {
+        write_log(LOG_ERROR, "callgraph: failed to open file '%s'", filename);
+        return 0;
+    }
+
+    /* path[len[n]] is where the name of n starts in the path */
+    size_t size = 4096, end = 0;
+    char *path = malloc(size);
+    size_t *len = malloc(count * sizeof(size_t));
+    int ok = path && len;
+
+    uint32_t n = m[0].child;
+    char name[SYMBOL_MAXLEN + 16];
+    while (ok && n)
+    {
+        format_name(syms, m[n].name, name, sizeof(name));
+        size_t need = end + strlen(name) + 2;
+        if (need > size)
+        {
+            char *p = realloc(path, need * 2);
+            if (!p)
+            {
+                ok = 0;
+                break;
+            }
+            path = p;
+            size = need * 2;
+        }
+        len[n] = end;
+        end += (size_t) sprintf(path + end, "%s%s", end ? ";" : "", name);
+        if (m[n].self)
+            fprintf(fp, "%s %llu\n", path, (unsigned long long) m[n].self);
+        NEXT_PATH(m, n, path[end = len[n]] = '\0');
+    }
+    if (!ok)
+        write_log(LOG_ERROR, "callgraph: out of memory");
+
+    free(len);
+    free(path);
+    if (fclose(fp) != 0)
+    {
+        write_log(LOG_ERROR, "callgraph: failed to write file '%s'", filename);
+        ok = 0;
+    }
+    return ok;
+}
+
+int write_callgraph(struct vm *vm, FILE *bin, const char *report_filename, const char *folded_filename)
+{
+    struct callgraph *cg = vm->callgraph;
+    if (!cg)
+        return 1;
+    charge(cg, vm->retired);
+
+    struct merged *m = malloc(cg->nnodes * sizeof(struct merged));
+    if (!m)
+    {
+        write_log(LOG_ERROR, "callgraph: out of memory");
+        return 0;
+    }
+
+    struct symbols syms;
+    load_symbols(&syms, bin);
+
+    int ok = 0;
+    uint32_t count = merge_paths(cg, &syms, m);
+    if (count)
+    {
+        ok = 1;
+        if (report_filename)
+            ok = write_report(m, &syms, report_filename) && ok;
+        if (folded_filename)
+            ok = write_folded(m, count, &syms, folded_filename) && ok;
+    }
+    else
+    {
+        write_log(LOG_ERROR, "callgraph: out of memory");
+    }
+
+    free_symbols(&syms);
+    free(m);
+    if (ok)
+        write_log(LOG_NORMAL, "callgraph: %u call paths written", count - 1);
+    return ok;
+}
@@ -0,0 +1,501 @@
+/* File: cmdline.c */
+/* Command line arguments parsing. */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Note: non-standard header, available on GNU systems */
+#include <getopt.h>
+
+#include "vm.h"
+#include "control.h"
+#include "devices.h"
+#include "farm.h"
+#include "sampler.h"
+#include "trace.h"
+#include "cmdline.h"
+
+extern char *exec_filename;
+extern int batch_mode;
+extern char *input_filename;
+extern char *output_filename;
+extern int exit_register;
+extern char *farm_filename;
+extern char *results_filename;
+extern int farm_workers;
+extern char *save_snapshot_filename;
+extern char *restore_snapshot_filename;
+extern uint64_t snapshot_at;
+extern char *profile_filename;
+extern char *callgraph_filename;
+extern char *folded_filename;
+extern char *sample_filename;
+extern struct vm_options options;
+
+static void print_usage(const char *prog)
+{
+    printf("ETF - System software - Emulator v1.0\n"
+           "Usage:\n\t%s [--engine=name] [--timer=mode] [--timer-period=n]\n"
+           "\t\t[--batch] [--input=file] [--output=file] [--exit-reg=rN]\n"
+           "\t\t[--save-snapshot=file [--snapshot-at=n]]\n"
+           "\t\t[--profile=file] [--callgraph=file] [--folded-stacks=file]\n"
+           "\t\t[--sample=file [--sample-period=n]]\n"
+           "\t\t[--trace=file [--trace-records=n] [--trace-pc=lo:hi] [--trace-insns=from:to]]\n"
+           "\t\t[--record=file | --replay=file] [--disk=file]\n"
+           "\t\t[--net-in=file] [--net-out=file] [--net-socket=path] [-h] exec_file\n"
+           "\t%s --restore-snapshot=file [--save-snapshot=file [--snapshot-at=n]] ...\n"
+           "\t%s --farm=manifest [--jobs=n] [--results=file] [--engine=name] [--exit-reg=rN] ...\n\n", prog, prog, prog);
+    printf("\t--engine=name    \t-- select execution engine: interp (default), threaded or jit\n"
+           "\t--timer=mode     \t-- select timer mode: virtual (default) or wall\n"
+           "\t--timer-period=n \t-- set timer period, in instructions (virtual) or milliseconds (wall)\n"
+           "\t--batch          \t-- run without a terminal, exit with the value of the exit register\n"
+           "\t--input=file     \t-- read guest input from file instead of standard input\n"
+           "\t--output=file    \t-- write guest output to file instead of standard output\n"
+           "\t--exit-reg=rN    \t-- exit register in batch and farm mode, r0 (default) to r7\n"
+           "\t--save-snapshot=file\t-- save the machine state to file when the CPU halts\n"
+           "\t--snapshot-at=n  \t-- instead stop and save it after n instructions\n"
+           "\t--restore-snapshot=file\t-- resume the machine saved in file\n"
+           "\t--profile=file   \t-- count instructions per address, write a hot-spot report to file\n"
+           "\t--callgraph=file \t-- keep a shadow call stack, write counts per routine to file\n"
+           "\t--folded-stacks=file\t-- keep a shadow call stack, write counts per call path to file\n"
+           "\t--sample=file    \t-- sample the PC, write the samples per address to file\n"
+           "\t--sample-period=n\t-- take a sample every n instructions, default %d\n"
+           "\t--trace=file     \t-- write a binary record of every instruction to file, see dec\n"
+           "\t--trace-records=n\t-- keep the last n records, default %d\n"
+           "\t--trace-pc=lo:hi \t-- trace only instructions at addresses lo to hi\n"
+           "\t--trace-insns=from:to\t-- trace only instructions retired after from and before to others\n"
+           "\t--record=file    \t-- write every input byte and timer tick to an event log\n"
+           "\t--replay=file    \t-- take input and timer ticks from an event log, at full speed\n"
+           "\t--disk=file      \t-- attach file as the disk of the block device\n"
+           "\t--net-in=file    \t-- receive packets from a pcap file\n"
+           "\t--net-out=file   \t-- send packets to a pcap file\n"
+           "\t--net-socket=path\t-- exchange packets over a Unix datagram socket bound at path\n"
+           "\t--farm=manifest  \t-- run every job of the manifest file on a pool of threads\n"
+           "\t--jobs=n         \t-- number of farm threads, one per CPU by default\n"
+           "\t--results=file   \t-- write farm results to file, as JSON if it ends with .json, else CSV\n"
+           "\t-h               \t-- print this message and exit\n", SAMPLER_DEFAULT_PERIOD, TRACE_DEFAULT_RECORDS);
+}
+
+static void parse_engine(const char *name)
+{
+    if (strcmp(name, "interp") == 0)
+        options.engine = ENGINE_INTERP;
+    else if (strcmp(name, "threaded") == 0)
+        options.engine = ENGINE_THREADED;
+    else if (strcmp(name, "jit") == 0)
+        options.engine = ENGINE_JIT;
+    else
+    {
+        fprintf(stderr, "Unknown engine '%s'\n", name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void parse_timer_mode(const char *name)
+{
+    if (strcmp(name, "virtual") == 0)
+        options.timer_mode = TIMER_VIRTUAL;
+    else if (strcmp(name, "wall") == 0)
+        options.timer_mode = TIMER_WALL_CLOCK;
+    else
+    {
+        fprintf(stderr, "Unknown timer mode '%s'\n", name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void parse_timer_period(const char *arg)
+{
+    char *end;
+    unsigned long long period = strtoull(arg, &end, 10);
+    if (!isdigit((unsigned char) *arg) || *end != '\0' || period == 0)
+    {
+        fprintf(stderr, "Invalid timer period '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    options.timer_period = period;
+}
+
+static void parse_exit_register(const char *arg)
+{
+    const char *reg = (arg[0] == 'r' || arg[0] == 'R') ? arg + 1 : arg;
+    if (reg[0] < '0' || reg[0] > '7' || reg[1] != '\0')
+    {
+        fprintf(stderr, "Invalid exit register '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    exit_register = reg[0] - '0';
+}
+
+static void parse_snapshot_at(const char *arg)
+{
+    char *end;
+    unsigned long long n = strtoull(arg, &end, 10);
+    if (!isdigit((unsigned char) *arg) || *end != '\0' || n == 0)
+    {
+        fprintf(stderr, "Invalid instruction count '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    snapshot_at = n;
+}
+
+static void parse_sample_period(const char *arg)
+{
+    char *end;
+    unsigned long long period = strtoull(arg, &end, 10);
+    if (!isdigit((unsigned char) *arg) || *end != '\0' || period == 0)
+    {
+        fprintf(stderr, "Invalid sample period '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    options.sample_period = period;
+}
+
+static void parse_trace_records(const char *arg)
+{
+    char *end;
+    unsigned long long n = strtoull(arg, &end, 10);
+    if (!isdigit((unsigned char) *arg) || *end != '\0' || n == 0 || n > TRACE_MAX_RECORDS)
+    {
+        fprintf(stderr, "Invalid number of trace records '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    options.trace_records = n;
+}
+
+/* Function parse_range parses "lo:hi" into lo and hi, either of which may be left
+ * out to keep its value. Numbers are decimal, or hexadecimal with a 0x prefix.
+ * Returns 0 if arg isn't a range. */
+static int parse_range(const char *arg, unsigned long long *lo, unsigned long long *hi)
+{
+    char *end;
+    if (*arg != ':')
+    {
+        if (!isdigit((unsigned char) *arg))
+            return 0;
+        *lo = strtoull(arg, &end, 0);
+        arg = end;
+    }
+    if (*arg++ != ':')
+        return 0;
+    if (*arg != '\0')
+    {
+        if (!isdigit((unsigned char) *arg))
+            return 0;
+        *hi = strtoull(arg, &end, 0);
+        arg = end;
+    }
+    return *arg == '\0';
+}
+
+static void parse_trace_pc(const char *arg)
+{
+    unsigned long long lo = 0, hi = 0xffff;
+    if (!parse_range(arg, &lo, &hi) || lo > hi || hi > 0xffff)
+    {
+        fprintf(stderr, "Invalid address range '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    options.trace_pc_lo = (uint16_t) lo;
+    options.trace_pc_hi = (uint16_t) hi;
+}
+
+static void parse_trace_insns(const char *arg)
+{
+    unsigned long long from = 0, to = 0;
+    if (!parse_range(arg, &from, &to) || (to && from >= to))
+    {
+        fprintf(stderr, "Invalid instruction range '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    options.trace_from = from;
+    options.trace_to = to;
+}
+
+static void parse_jobs(const char *arg)
+{
+    char *end;
+    long jobs = strtol(arg, &end, 10);
+    if (!isdigit((unsigned char) *arg) || *end != '\0' || jobs < 1 || jobs > FARM_MAX_WORKERS)
+    {
+        fprintf(stderr, "Invalid number of jobs '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    farm_workers = (int) jobs;
+}
+
+/* Values getopt_long returns for the long options, none of which has a short form. */
+enum {
+    OPT_ENGINE = 256,
+    OPT_TIMER,
+    OPT_TIMER_PERIOD,
+    OPT_BATCH,
+    OPT_INPUT,
+    OPT_OUTPUT,
+    OPT_EXIT_REG,
+    OPT_SAVE_SNAPSHOT,
+    OPT_SNAPSHOT_AT,
+    OPT_RESTORE_SNAPSHOT,
+    OPT_PROFILE,
+    OPT_CALLGRAPH,
+    OPT_FOLDED_STACKS,
+    OPT_SAMPLE,
+    OPT_SAMPLE_PERIOD,
+    OPT_TRACE,
+    OPT_TRACE_RECORDS,
+    OPT_TRACE_PC,
+    OPT_TRACE_INSNS,
+    OPT_RECORD,
+    OPT_REPLAY,
+    OPT_DISK,
+    OPT_NET_IN,
+    OPT_NET_OUT,
+    OPT_NET_SOCKET,
+    OPT_FARM,
+    OPT_JOBS,
+    OPT_RESULTS,
+};
+
+void parse_cmdline(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "engine",           required_argument, NULL, OPT_ENGINE },
+        { "timer",            required_argument, NULL, OPT_TIMER },
+        { "timer-period",     required_argument, NULL, OPT_TIMER_PERIOD },
+        { "batch",            no_argument,       NULL, OPT_BATCH },
+        { "input",            required_argument, NULL, OPT_INPUT },
+        { "output",           required_argument, NULL, OPT_OUTPUT },
+        { "exit-reg",         required_argument, NULL, OPT_EXIT_REG },
+        { "save-snapshot",    required_argument, NULL, OPT_SAVE_SNAPSHOT },
+        { "snapshot-at",      required_argument, NULL, OPT_SNAPSHOT_AT },
+        { "restore-snapshot", required_argument, NULL, OPT_RESTORE_SNAPSHOT },
+        { "profile",          required_argument, NULL, OPT_PROFILE },
+        { "callgraph",        required_argument, NULL, OPT_CALLGRAPH },
+        { "folded-stacks",    required_argument, NULL, OPT_FOLDED_STACKS },
+        { "sample",           required_argument, NULL, OPT_SAMPLE },
+        { "sample-period",    required_argument, NULL, OPT_SAMPLE_PERIOD },
+        { "trace",            required_argument, NULL, OPT_TRACE },
+        { "trace-records",    required_argument, NULL, OPT_TRACE_RECORDS },
+        { "trace-pc",         required_argument, NULL, OPT_TRACE_PC },
+        { "trace-insns",      required_argument, NULL, OPT_TRACE_INSNS },
+        { "record",           required_argument, NULL, OPT_RECORD },
+        { "replay",           required_argument, NULL, OPT_REPLAY },
+        { "disk",             required_argument, NULL, OPT_DISK },
+        { "net-in",           required_argument, NULL, OPT_NET_IN },
+        { "net-out",          required_argument, NULL, OPT_NET_OUT },
+        { "net-socket",       required_argument, NULL, OPT_NET_SOCKET },
+        { "farm",             required_argument, NULL, OPT_FARM },
+        { "jobs",             required_argument, NULL, OPT_JOBS },
+        { "results",          required_argument, NULL, OPT_RESULTS },
+        { "help",             no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int c;
+
+    opterr = 0;
+
+    while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case OPT_ENGINE:
+            parse_engine(optarg);
+            break;
+        case OPT_TIMER:
+            parse_timer_mode(optarg);
+            break;
+        case OPT_TIMER_PERIOD:
+            parse_timer_period(optarg);
+            break;
+        case OPT_BATCH:
+            batch_mode = 1;
+            break;
+        case OPT_INPUT:
+            input_filename = optarg;
+            break;
+        case OPT_OUTPUT:
+            output_filename = optarg;
+            break;
+        case OPT_EXIT_REG:
+            parse_exit_register(optarg);
+            break;
+        case OPT_SAVE_SNAPSHOT:
+            save_snapshot_filename = optarg;
+            break;
+        case OPT_SNAPSHOT_AT:
+            parse_snapshot_at(optarg);
+            break;
+        case OPT_RESTORE_SNAPSHOT:
+            restore_snapshot_filename = optarg;
+            break;
+        case OPT_PROFILE:
+            profile_filename = optarg;
+            options.profile = 1;
+            break;
+        case OPT_CALLGRAPH:
+            callgraph_filename = optarg;
+            options.callgraph = 1;
+            break;
+        case OPT_FOLDED_STACKS:
+            folded_filename = optarg;
+            options.callgraph = 1;
+            break;
+        case OPT_SAMPLE:
+            sample_filename = optarg;
+            break;
+        case OPT_SAMPLE_PERIOD:
+            parse_sample_period(optarg);
+            break;
+        case OPT_TRACE:
+            options.trace_filename = optarg;
+            break;
+        case OPT_TRACE_RECORDS:
+            parse_trace_records(optarg);
+            break;
+        case OPT_TRACE_PC:
+            parse_trace_pc(optarg);
+            break;
+        case OPT_TRACE_INSNS:
+            parse_trace_insns(optarg);
+            break;
+        case OPT_RECORD:
+            options.record_filename = optarg;
+            break;
+        case OPT_REPLAY:
+            options.replay_filename = optarg;
+            break;
+        case OPT_DISK:
+            options.disk_filename = optarg;
+            break;
+        case OPT_NET_IN:
+            options.net_in_filename = optarg;
+            break;
+        case OPT_NET_OUT:
+            options.net_out_filename = optarg;
+            break;
+        case OPT_NET_SOCKET:
+            options.net_socket = optarg;
+            break;
+        case OPT_FARM:
+            farm_filename = optarg;
+            break;
+        case OPT_JOBS:
+            parse_jobs(optarg);
+            break;
+        case OPT_RESULTS:
+            results_filename = optarg;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+            break;
+        case '?':
+            if (optopt >= OPT_ENGINE)
+            {
+                const struct option *o = long_options;
+                while (o->val != optopt)
+                    ++o;
+                fprintf(stderr, "Option --%s requires an argument\n", o->name);
+            }
+            else if (optopt == 0)
+            {
+                fprintf(stderr, "Unknown option '%s'\n", argv[optind - 1]);
+            }
+            else if (isprint(optopt))
+            {
+                fprintf(stderr, "Unknown option '-%c'\n", optopt);
+            }
+            else
+            {
+                fprintf(stderr, "Unknown option character '\\x%x'\n", optopt);
+            }
+            exit(EXIT_FAILURE);
+            break;
+        default:
+            abort();
+            break;
+        }
+    }
+
+    /* the period alone doesn't ask for samples */
+    if (!sample_filename)
+        options.sample_period = 0;
+    else if (!options.sample_period)
+        options.sample_period = SAMPLER_DEFAULT_PERIOD;
+
+    if (options.record_filename && options.replay_filename)
+    {
+        fprintf(stderr, "%s can't both record and replay an event log\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (options.net_socket && (options.net_in_filename || options.net_out_filename))
+    {
+        fprintf(stderr, "%s can't both use packet files and a packet socket\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int index = optind;
+    if (farm_filename)
+    {
+        if (index != argc)
+        {
+            fprintf(stderr, "%s doesn't take an input file with --farm\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (options.profile || options.callgraph || options.sample_period)
+        {
+            fprintf(stderr, "%s doesn't profile with --farm\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (options.trace_filename)
+        {
+            fprintf(stderr, "%s doesn't trace with --farm\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (options.record_filename || options.replay_filename)
+        {
+            fprintf(stderr, "%s doesn't record or replay with --farm\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (options.disk_filename)
+        {
+            fprintf(stderr, "%s doesn't attach a disk with --farm\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (options.net_in_filename || options.net_out_filename || options.net_socket)
+        {
+            fprintf(stderr, "%s doesn't attach a packet device with --farm\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    if (restore_snapshot_filename)
+    {
+        if (index != argc)
+        {
+            fprintf(stderr, "%s doesn't take an input file with --restore-snapshot\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (options.record_filename || options.replay_filename)
+        {
+            fprintf(stderr, "%s doesn't record or replay with --restore-snapshot\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    if (index == argc)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_SUCCESS);
+    }
+    if (argc - index > 1)
+    {
+        fprintf(stderr, "%s allows at most one input file\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    exec_filename = argv[index];
+}
@@ -1,80 +1,235 @@
 /* File: control.c */
 /* CPU control unit. */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* Note: non-standard headers, available on POSIX systems */
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "log.h"
 #include "obj_format.h"
-#include "mem.h"
-#include "cpu.h"
+#include "vm.h"
 #include "fetch.h"
 #include "decode.h"
 #include "exec.h"
+#include "alu.h"
 #include "intr.h"
 #include "devices.h"
+#include "sched.h"
+#include "threaded.h"
+#include "jit.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "sampler.h"
+#include "trace.h"
+#include "idle.h"
 #include "control.h"
 
-static SymbolTable symtab;
+/* Function load_image copies the segments of executable image exe, of size bytes,
+ * into the memory of vm and finds the value of symbol START. The image holds the
+ * symbol table, the program header table and the segments, in that order. */
+static int load_image(struct vm *vm, const unsigned char *exe, size_t size, uint16_t *start_addr)
+{
+    size_t pos = 0;
+    uint32_t count;
+
+    /* symbol table, scanned in place for START */
+    if (size - pos < sizeof(uint32_t))
+        goto invalid;
+    memcpy(&count, exe + pos, sizeof(uint32_t));
+    pos += sizeof(uint32_t);
+    if (count > (size - pos) / sizeof(SymbolTableEntry))
+        goto invalid;
+
+    int found = 0;
+    uint32_t i;
+    for (i = 0; i < count; ++i, pos += sizeof(SymbolTableEntry))
+    {
+        const unsigned char *entry = exe + pos;
+        const char *name = (const char *) entry + offsetof(SymbolTableEntry, sym_name);
+        if (!found && strncmp(name, "START", SYMBOL_MAXLEN + 1) == 0)
+        {
+            memcpy(start_addr, entry + offsetof(SymbolTableEntry, sym_val), sizeof(uint16_t));
+            found = 1;
+        }
+    }
+    if (!found)
+    {
+        write_log(LOG_ERROR, "failed to find 'START'");
+        return 0;
+    }
+
+    /* program header table, followed by the contents of its segments */
+    if (size - pos < sizeof(uint32_t))
+        goto invalid;
+    memcpy(&count, exe + pos, sizeof(uint32_t));
+    pos += sizeof(uint32_t);
+    if (count > (size - pos) / sizeof(SegmentRecord))
+        goto invalid;
+
+    size_t data = pos + count * sizeof(SegmentRecord);
+    for (i = 0; i < count; ++i, pos += sizeof(SegmentRecord))
+    {
+        SegmentRecord segment;
+        memcpy(&segment, exe + pos, sizeof(SegmentRecord));
+        if (segment.size > (uint32_t)(MEM_SIZE - segment.load_addr) || segment.size > size - data)
+            goto invalid;
+        memcpy(vm->mem + segment.load_addr, exe + data, segment.size);
+        data += segment.size;
+    }
 
-static ProgramHeaderTable prog_hdrtab;
+    return 1;
 
-/* Note: assumed bin is a valid executable file. No error checking performed. */
-void load(FILE *bin)
+invalid:
+    write_log(LOG_ERROR, "invalid executable file");
+    return 0;
+}
+
+/* Function load_flat maps the memory image of flat executable fd, of size bytes,
+ * over the memory of vm. */
+static int load_flat(struct vm *vm, int fd, size_t size, const FlatHeader *hdr, uint16_t *start_addr)
 {
-    read_symtab(&symtab, bin);
-    read_program_hdrtab(&prog_hdrtab, bin);
-    ProgramHeaderNode *prog_hdrtab_node = NULL;
-    for (prog_hdrtab_node = prog_hdrtab.first; prog_hdrtab_node; prog_hdrtab_node = prog_hdrtab_node->next)
+    if (hdr->version != FLAT_VERSION || size < FLAT_IMAGE_OFFSET + FLAT_IMAGE_SIZE
+        || !(hdr->segment_map[hdr->entry / FLAT_PAGE_SIZE / 8] & (1 << (hdr->entry / FLAT_PAGE_SIZE % 8))))
     {
-        SegmentRecord segment = prog_hdrtab_node->record;
-        read_section(mem + segment.load_addr, segment.size, bin);
+        write_log(LOG_ERROR, "invalid flat executable file");
+        return 0;
     }
+
+    void *mem = mmap(vm->mem, MEM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, FLAT_IMAGE_OFFSET);
+    if (mem == MAP_FAILED)
+    {
+        write_log(LOG_ERROR, "failed to map the executable file");
+        return 0;
+    }
+
+    *start_addr = hdr->entry;
+    return 1;
 }
 
-void init_cpu(void)
+/* Function load maps executable file bin and loads it into vm. */
+static int load(struct vm *vm, FILE *bin, uint16_t *start_addr)
 {
-    SymbolTableEntry *start = find_symbol(&symtab, "START");
-    if (!start)
+    int fd = fileno(bin);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
     {
-        write_log(LOG_ERROR, "failed to find 'START'");
-        exit(EXIT_FAILURE);
+        write_log(LOG_ERROR, "failed to read the executable file");
+        return 0;
+    }
+
+    size_t size = (size_t) st.st_size;
+
+    FlatHeader hdr;
+    if (size >= sizeof(FlatHeader) && pread(fd, &hdr, sizeof(FlatHeader), 0) == (ssize_t) sizeof(FlatHeader)
+        && memcmp(hdr.magic, FLAT_MAGIC, sizeof(hdr.magic)) == 0)
+        return load_flat(vm, fd, size, &hdr, start_addr);
+
+    void *exe = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (exe == MAP_FAILED)
+    {
+        write_log(LOG_ERROR, "failed to map the executable file");
+        return 0;
     }
 
+    int ok = load_image(vm, exe, size, start_addr);
+    munmap(exe, size);
+    return ok;
+}
+
+static void init_cpu(struct vm *vm, uint16_t start_addr)
+{
     /* interrupt vector table starts at address 0 */
-    ivtp = 0;
+    vm->ivtp = 0;
 
     /* generate interrupt at startup */
-    intr = 1;
-    ivtentry = CPU_RESET_IVTENTRY;
+    vm->intr = 1;
+    vm->ivtentry = CPU_RESET_IVTENTRY;
 
-    cpu_context.psw = 0;
-    PSW_SET_FLAG(PSW_FLAG_T);
+    vm->cpu_context.psw = 0;
+    PSW_SET_FLAG(vm, PSW_FLAG_T);
 
     /* reg[7] used as PC */
-    cpu_context.reg[7] = start->sym_val;
+    vm->cpu_context.reg[7] = start_addr;
 
     /* reg[6] used as SP */
-    cpu_context.reg[6] = (int16_t) 0xff7f;
+    vm->cpu_context.reg[6] = (int16_t) 0xff7f;
+}
+
+/* Function budget_event stops the CPU once options.max_insns instructions are retired. */
+static void budget_event(struct vm *vm)
+{
+    vm->out_of_budget = 1;
+    PSW_SET_FLAG(vm, PSW_FLAG_H);
+}
+
+int run(struct vm *vm, FILE *bin)
+{
+    uint16_t start_addr;
+    if (!load(vm, bin, &start_addr))
+        return 0;
+    init_cpu(vm, start_addr);
+
+    resume(vm);
+    return 1;
 }
 
-void run(FILE *bin)
+void resume(struct vm *vm)
 {
-    load(bin);
-    init_cpu();
-    init_timer();
+    vm->out_of_budget = 0;
+    if (vm->options.max_insns)
+        sched_at(vm, vm->retired + vm->options.max_insns, budget_event);
+    if (vm->callgraph)
+        callgraph_start(vm);
+    if (vm->sampler)
+        sampler_start(vm);
 
-    while (!PSW_TEST_FLAG(PSW_FLAG_H))
+    if (vm->options.engine == ENGINE_THREADED)
     {
-        fetch();
-        decode();
-        if (!ILLEGAL_INSTRUCTION)
+        run_threaded(vm);
+    }
+    else if (vm->options.engine == ENGINE_JIT)
+    {
+        run_jit(vm);
+    }
+    else
+    {
+        struct profile *prof = vm->profile;
+        struct trace *trace = vm->trace;
+        while (!PSW_TEST_FLAG(vm, PSW_FLAG_H))
         {
-            execute();
-            signal_output_device();
+            uint16_t pc = (uint16_t) vm->cpu_context.reg[7];
+            int held = 1;
+            fetch(vm);
+            decode(vm);
+            if (!ILLEGAL_INSTRUCTION(vm))
+            {
+                if (prof || trace)
+                    held = test_condition(vm, (vm->ir0 >> 14) & 0x3);
+                if (prof && !held)
+                    ++prof->not_taken[pc];
+                execute(vm);
+                if (vm->fetched->handler == ICACHE_JCC && (uint16_t) vm->cpu_context.reg[7] <= pc)
+                    idle_branch(vm, pc);
+            }
+            if (prof)
+                ++prof->count[pc];
+            if (trace)
+                trace_insn(vm, pc, held);
+            ++vm->retired;
+            interrupt(vm);
+            sched_poll(vm);
         }
-        interrupt();
-        poll_timer();
-        poll_input_device();
     }
-}
 
+    /* the CPU halted, or stopped with its state intact */
+    if (vm->out_of_budget)
+        PSW_CLEAR_FLAG(vm, PSW_FLAG_H);
+    flush_output(vm);
+}
@@ -4,66 +4,54 @@
 #include <stdlib.h>
 
 #include "log.h"
-#include "cpu.h"
-#include "mem.h"
+#include "vm.h"
 #include "constants.h"
+#include "icache.h"
+#include "alu.h"
+#include "fetch.h"
 #include "intr.h"
 #include "decode.h"
 
-int memory_dst;
-
-void decode(void)
+void decode(struct vm *vm)
 {
-    memory_dst = 0;
-    mar = (uint16_t) 0xffff;
+    vm->memory_dst = 0;
+    vm->mar = (uint16_t) 0xffff;
 
-    int reg_idx[2];
-    int address_mode[2];
-    reg_idx[0] = (ir0 >> 5) & 0x7;
-    reg_idx[1] = ir0 & 0x7;
-    address_mode[0] = (ir0 >> 8) & 0x3;
-    address_mode[1] = (ir0 >> 3) & 0x3;
-    int opcode = (ir0 >> 10) & 0x000f;
+    if (vm->fetched->illegal) /* illegal instruction */
+    {
+        vm->intr = 1;
+        vm->ivtentry = 2;
+        return;
+    }
 
     int i;
     for (i = 0; i < 2; ++i)
     {
-        switch (address_mode[i])
+        switch (vm->fetched->kind[i])
         {
-        case IMMED:
-            if (reg_idx[i] == 0x7)
-            {
-                /* if IMMED addressed operand's register field is 0x7, PSW is used */
-                operand[i] = &cpu_context.psw;
-            }
-            else
-            {
-                operand[i] = &ir1;
-
-                if (i == 0 && opcode != PUSH && opcode != IRET) /* illegal instruction */
-                {
-                    intr = 1;
-                    ivtentry = 2;
-                    return;
-                }
-            }
+        case OPND_IMMED:
+            vm->operand[i] = &vm->ir1;
+            break;
+        case OPND_PSW:
+            /* if IMMED addressed operand's register field is 0x7, PSW is used */
+            psw_sync(vm);
+            vm->operand[i] = &vm->cpu_context.psw;
             break;
-        case REGDIR:
-            operand[i] = &cpu_context.reg[reg_idx[i]];
+        case OPND_REG:
+            vm->operand[i] = &vm->cpu_context.reg[vm->fetched->reg[i]];
             break;
-        case MEMDIR:
-            mar = (uint16_t) ir1;
-            operand[i] = (int16_t *)(mem + mar);
-            if (i == 0) memory_dst = 1;
+        case OPND_MEM:
+            vm->mar = (uint16_t) vm->ir1;
+            vm->operand[i] = (int16_t *)(vm->mem + vm->mar);
+            if (i == 0) vm->memory_dst = 1;
             break;
-        case REGINDDISP:
-            mar = (uint16_t)(cpu_context.reg[reg_idx[i]] + ir1);
-            operand[i] = (int16_t *)(mem + mar);
-            if (i == 0) memory_dst = 1;
+        case OPND_REGIND:
+            vm->mar = (uint16_t)(vm->cpu_context.reg[vm->fetched->reg[i]] + vm->ir1);
+            vm->operand[i] = (int16_t *)(vm->mem + vm->mar);
+            if (i == 0) vm->memory_dst = 1;
             break;
         default:
             break;
         }
     }
 }
-
@@ -1,73 +1,570 @@
 /* File: devices.c */
 /* Peripheral devices emulation. */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 
 /* Note: non-standard headers, available on POSIX systems */
+#include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
-#include "cpu.h"
-#include "mem.h"
+#include "log.h"
+#include "vm.h"
 #include "intr.h"
 #include "exec.h"
+#include "mmio.h"
+#include "sched.h"
 #include "devices.h"
+#include "replay.h"
+#include "net.h"
+
+/* Console state: output buffer and input ring buffer. */
+struct console {
+    /* Output buffer, written to options.output_fd by flush_output. */
+    char output_buffer[OUTPUT_BUFFER_SIZE];
+    size_t output_len;
+
+    /* Set if output is a terminal, to flush at the end of every line. */
+    int output_tty;
+
+    /* Input ring buffer, filled by the reader thread and drained by the CPU.
+     * Indices run freely and are reduced modulo INPUT_BUFFER_SIZE on access. */
+    char input_buffer[INPUT_BUFFER_SIZE];
+    atomic_uint input_head; /* next byte to be consumed, written by the CPU */
+    atomic_uint input_tail; /* next free slot, written by the reader thread */
+
+    /* Set by the reader thread when bytes are waiting in the input buffer. */
+    atomic_int input_pending;
+
+    /* Cleared when the end of input is reached. */
+    atomic_int input_open;
+
+    /* Set if input is a regular file. It is then read on the CPU thread whenever the buffer
+     * runs empty, so input is delivered at the same instructions in every run. */
+    int input_regular;
+
+    /* Reader thread, stopped by close_input_device through the wake pipe. */
+    pthread_t reader;
+    int reader_running;
+    atomic_int reader_stop;
+    int wake[2];
+
+    /* Set while the CPU sleeps in wait_for_devices. The reader thread then
+     * wakes it up through the notify pipe when it adds input. */
+    atomic_int sleeping;
+    int notify[2];
+};
+
+/* Timer state. */
+struct timer {
+    /* Next tick in virtual mode, in retired instructions. */
+    uint64_t virtual_deadline;
+
+    /* Next tick in wall-clock mode, in nanoseconds of CLOCK_MONOTONIC. */
+    uint64_t wall_deadline;
+};
+
+void flush_output(struct vm *vm)
+{
+    struct console *c = vm->console;
+    size_t done = 0;
+    while (done < c->output_len)
+    {
+        ssize_t status = write(vm->options.output_fd, c->output_buffer + done, c->output_len - done);
+        if (status < 0 && errno == EINTR)
+            continue;
+        if (status <= 0)
+            break; /* output is lost, as it was with unbuffered writes */
+        done += (size_t) status;
+    }
+    c->output_len = 0;
+}
+
+/* Number of the signal that requested termination, see install_stop_handler. */
+static volatile sig_atomic_t stop_signal;
+
+/* Pipe written by the stop handler, so it wakes up CPU threads sleeping in wait_for_devices
+ * whichever thread takes the signal. */
+static int stop_pipe[2] = { -1, -1 };
+
+static void stop_handler(int sig)
+{
+    int saved_errno = errno;
+    stop_signal = sig;
+    if (stop_pipe[1] >= 0)
+    {
+        ssize_t status = write(stop_pipe[1], "", 1);
+        (void) status;
+    }
+    errno = saved_errno;
+}
+
+/* Function install_stop_handler makes SIGINT, SIGTERM and SIGHUP stop every CPU at its
+ * next console check, so the emulator shuts down the way it does when the CPU halts. */
+static void install_stop_handler(void)
+{
+    if (pipe(stop_pipe) != 0)
+        stop_pipe[0] = stop_pipe[1] = -1;
+    else
+        fcntl(stop_pipe[1], F_SETFL, O_NONBLOCK);
+
+    struct sigaction action = { .sa_handler = stop_handler };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGHUP, &action, NULL);
+}
+
+int stop_signal_caught(void)
+{
+    return stop_signal;
+}
+
+static void output_register_write(struct vm *vm, uint16_t reg)
+{
+    output_device(vm, (char) vm->mem[reg]);
+}
+
+/* Function output_buffer_write sends the buffer described by the DMA registers. */
+static void output_buffer_write(struct vm *vm, uint16_t reg)
+{
+    struct console *c = vm->console;
+    size_t addr = (size_t)(vm->mem[OUTPUT_DMA_ADDRESS] | vm->mem[OUTPUT_DMA_ADDRESS + 1] << 8);
+    size_t end = addr + (size_t)(vm->mem[reg] | vm->mem[reg + 1] << 8);
+    if (end > MMIO_BASE)
+        end = MMIO_BASE;
+
+    int newline = 0;
+    for (; addr < end; ++addr)
+    {
+        char ch = (char) vm->mem[addr];
+        if (ch <= 0 || (ch != 0x0d && !isprint(ch)))
+            continue;
+        if (c->output_len + 2 > OUTPUT_BUFFER_SIZE)
+            flush_output(vm);
+
+        if (ch == 0x0d)
+        {
+            c->output_buffer[c->output_len++] = '\r';
+            c->output_buffer[c->output_len++] = '\n';
+            newline = 1;
+        }
+        else
+            c->output_buffer[c->output_len++] = ch;
+    }
+    if (newline && c->output_tty)
+        flush_output(vm);
+}
+
+int init_output_device(struct vm *vm)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, install_stop_handler);
+
+    if (!mmio_attach(vm, OUTPUT_DEVICE_ADDRESS, 1, NULL, output_register_write)
+        || !mmio_attach(vm, OUTPUT_DMA_ADDRESS, 2, NULL, NULL)
+        || !mmio_attach(vm, OUTPUT_DMA_LENGTH, 2, NULL, output_buffer_write))
+        return 0;
+
+    vm->console = calloc(1, sizeof(struct console));
+    if (!vm->console)
+        return 0;
+    vm->console->wake[0] = vm->console->wake[1] = -1;
+    vm->console->notify[0] = vm->console->notify[1] = -1;
+    vm->console->output_tty = isatty(vm->options.output_fd);
+    return 1;
+}
+
+void close_output_device(struct vm *vm)
+{
+    if (!vm->console)
+        return;
+    flush_output(vm);
+    free(vm->console);
+    vm->console = NULL;
+}
 
-void output_device(char ch)
+void output_device(struct vm *vm, char ch)
 {
+    struct console *c = vm->console;
     if (ch > 0 && (ch == 0x0d || isprint(ch)))
     {
+        if (c->output_len + 2 > OUTPUT_BUFFER_SIZE)
+            flush_output(vm);
+
         if (ch == 0x0d)
-            write(STDOUT_FILENO, "\r\n", 2);
+        {
+            c->output_buffer[c->output_len++] = '\r';
+            c->output_buffer[c->output_len++] = '\n';
+            if (c->output_tty)
+                flush_output(vm);
+        }
         else
-            write(STDOUT_FILENO, &ch, 1);
+            c->output_buffer[c->output_len++] = ch;
+    }
+}
+
+void input_device(struct vm *vm, char ch)
+{
+    mmio_set(vm, INPUT_DEVICE_ADDRESS, (uint8_t) ch);
+    vm->intr = 1;
+    vm->ivtentry = INPUT_DEVICE_IVTENTRY;
+    if (vm->replay)
+        record_event(vm, REPLAY_INPUT, (unsigned char) ch);
+}
+
+/* Function read_input reads from the input file into the free space of the input ring buffer.
+ * Returns the result of read, or 1 if there is no free space. */
+static ssize_t read_input(struct vm *vm)
+{
+    struct console *c = vm->console;
+    unsigned tail = atomic_load_explicit(&c->input_tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&c->input_head, memory_order_acquire);
+    unsigned space = INPUT_BUFFER_SIZE - (tail - head);
+    if (space == 0)
+        return 1;
+
+    /* read up to the end of the free space or the end of the array, whichever comes first */
+    unsigned offset = tail % INPUT_BUFFER_SIZE;
+    unsigned count = INPUT_BUFFER_SIZE - offset;
+    if (count > space)
+        count = space;
+
+    ssize_t status = read(vm->options.input_fd, c->input_buffer + offset, count);
+    if (status > 0)
+    {
+        atomic_store_explicit(&c->input_tail, tail + (unsigned) status, memory_order_release);
+        atomic_store_explicit(&c->input_pending, 1, memory_order_release);
+    }
+    return status;
+}
+
+/* Function input_reader moves bytes from the input file into the input ring buffer.
+ * It blocks in poll while there is no input, so the CPU never makes a syscall to check for it. */
+static void *input_reader(void *arg)
+{
+    struct vm *vm = arg;
+    struct console *c = vm->console;
+
+    struct pollfd pfd[2] = {
+        { .fd = vm->options.input_fd, .events = POLLIN },
+        { .fd = c->wake[0], .events = POLLIN },
+    };
+    while (!atomic_load_explicit(&c->reader_stop, memory_order_relaxed))
+    {
+        unsigned tail = atomic_load_explicit(&c->input_tail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&c->input_head, memory_order_acquire);
+        if (tail - head == INPUT_BUFFER_SIZE)
+        {
+            /* the guest is not keeping up, wait for it to drain the buffer */
+            struct timespec delay = { .tv_sec = 0, .tv_nsec = 1000000 };
+            nanosleep(&delay, NULL);
+            continue;
+        }
+
+        if (poll(pfd, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (pfd[1].revents)
+            break; /* woken up by close_input_device */
+
+        ssize_t status = read_input(vm);
+        if (status < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (status <= 0)
+            break; /* end of input */
+
+        /* pairs with the fence in wait_for_devices */
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_exchange_explicit(&c->sleeping, 0, memory_order_relaxed))
+        {
+            char byte = 0;
+            while (write(c->notify[1], &byte, 1) < 0 && errno == EINTR)
+                ;
+        }
+    }
+
+    atomic_store_explicit(&c->input_open, 0, memory_order_relaxed);
+    return NULL;
+}
+
+static void receive_input(struct vm *vm);
+
+/* Function console_event checks the input buffer every INPUT_POLL_INTERVAL instructions. */
+static void console_event(struct vm *vm)
+{
+    struct console *c = vm->console;
+
+    if (stop_signal)
+    {
+        /* stopped with its state intact, like at the end of the budget */
+        vm->out_of_budget = 1;
+        PSW_SET_FLAG(vm, PSW_FLAG_H);
+        return;
+    }
+
+    if (c->input_regular && !atomic_load_explicit(&c->input_pending, memory_order_relaxed)
+        && atomic_load_explicit(&c->input_open, memory_order_relaxed) && read_input(vm) <= 0)
+        atomic_store_explicit(&c->input_open, 0, memory_order_relaxed);
+
+    if (atomic_load_explicit(&c->input_pending, memory_order_relaxed))
+        receive_input(vm);
+    else if (c->output_len > 0 && atomic_load_explicit(&c->input_open, memory_order_relaxed))
+        flush_output(vm); /* the guest may be waiting for input in response to its output */
+    sched_at(vm, vm->retired + INPUT_POLL_INTERVAL, console_event);
+}
+
+int init_input_device(struct vm *vm)
+{
+    struct console *c = vm->console;
+
+    /* the guest reads the data register like memory */
+    if (!mmio_attach(vm, INPUT_DEVICE_ADDRESS, 1, NULL, NULL))
+        return 0;
+
+    sched_at(vm, vm->retired + INPUT_POLL_INTERVAL, console_event);
+
+    if (vm->options.input_fd < 0 || vm->options.replay_filename)
+        return 1; /* no input, or input replayed from the event log */
+
+    atomic_store_explicit(&c->input_open, 1, memory_order_relaxed);
+
+    struct stat st;
+    if (fstat(vm->options.input_fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        c->input_regular = 1;
+        return 1;
+    }
+
+    if (pipe(c->wake) != 0 || pipe(c->notify) != 0)
+    {
+        write_log(LOG_ERROR, "failed to create the input reader wake-up pipes");
+        return 0;
     }
+    if (pthread_create(&c->reader, NULL, input_reader, vm) != 0)
+    {
+        atomic_store_explicit(&c->input_open, 0, memory_order_relaxed);
+        write_log(LOG_ERROR, "failed to start the input reader thread");
+        return 1;
+    }
+    c->reader_running = 1;
+    return 1;
 }
 
-void signal_output_device(void)
+void close_input_device(struct vm *vm)
 {
-    if (memory_write && (uint16_t) mar == OUTPUT_DEVICE_ADDRESS)
+    struct console *c = vm->console;
+    if (!c)
+        return;
+
+    if (c->reader_running)
+    {
+        atomic_store_explicit(&c->reader_stop, 1, memory_order_relaxed);
+        char byte = 0;
+        while (write(c->wake[1], &byte, 1) < 0 && errno == EINTR)
+            ;
+        pthread_join(c->reader, NULL);
+        c->reader_running = 0;
+    }
+    int i;
+    for (i = 0; i < 2; ++i)
     {
-        char ch = mem[OUTPUT_DEVICE_ADDRESS];
-        output_device(ch);
+        if (c->wake[i] >= 0)
+            close(c->wake[i]);
+        if (c->notify[i] >= 0)
+            close(c->notify[i]);
+        c->wake[i] = c->notify[i] = -1;
     }
 }
 
-void input_device(char ch)
+/* Function receive_input stores the next byte from the input buffer
+ * at memory address INPUT_DEVICE_ADDRESS, if there is one. */
+static void receive_input(struct vm *vm)
 {
-    mem[INPUT_DEVICE_ADDRESS] = ch;
-    intr = 1;
-    ivtentry = INPUT_DEVICE_IVTENTRY;
+    struct console *c = vm->console;
+
+    /* hold the byte until the CPU can take its interrupt, so it doesn't overwrite the previous one */
+    if (vm->intr || PSW_TEST_FLAG(vm, PSW_FLAG_I))
+        return;
+
+    unsigned head = atomic_load_explicit(&c->input_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&c->input_tail, memory_order_acquire);
+    if (head == tail)
+    {
+        atomic_store_explicit(&c->input_pending, 0, memory_order_relaxed);
+
+        /* the reader may have appended a byte after tail was loaded */
+        if (atomic_load_explicit(&c->input_tail, memory_order_acquire) != tail)
+            atomic_store_explicit(&c->input_pending, 1, memory_order_relaxed);
+        return;
+    }
+
+    char ch = c->input_buffer[head % INPUT_BUFFER_SIZE];
+    atomic_store_explicit(&c->input_head, head + 1, memory_order_release);
+    input_device(vm, ch);
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
 }
 
-void poll_input_device(void)
+/* Function timer_event generates a timer tick when it is due. */
+static void timer_event(struct vm *vm)
 {
-    char ch;
-    int status = read(STDIN_FILENO, &ch, 1);
-    if (status == 0)
+    struct timer *t = vm->timer;
+    uint64_t period = vm->options.timer_period;
+
+    if (vm->options.timer_mode == TIMER_WALL_CLOCK && monotonic_ns() < t->wall_deadline)
+    {
+        sched_at(vm, vm->retired + WALL_CLOCK_CHECK_INTERVAL, timer_event);
+        return;
+    }
+
+    /* an interrupt raised by another device for this instruction would be overwritten */
+    if (vm->intr && !PSW_TEST_FLAG(vm, PSW_FLAG_I))
+    {
+        sched_at(vm, vm->retired + 1, timer_event);
         return;
-    input_device(ch);
+    }
+
+    if (PSW_TEST_FLAG(vm, PSW_FLAG_T))
+    {
+        vm->intr = 1;
+        vm->ivtentry = TIMER_TICK_IVTENTRY;
+        if (vm->replay)
+            record_event(vm, REPLAY_TIMER, 0);
+    }
+
+    if (vm->options.timer_mode == TIMER_WALL_CLOCK)
+    {
+        /* ticks missed while the host was busy elsewhere are dropped, not queued */
+        t->wall_deadline = monotonic_ns() + period * 1000000;
+        sched_at(vm, vm->retired + WALL_CLOCK_CHECK_INTERVAL, timer_event);
+    }
+    else
+    {
+        t->virtual_deadline += period;
+        if (t->virtual_deadline <= vm->retired)
+            t->virtual_deadline = vm->retired + 1;
+        sched_at(vm, t->virtual_deadline, timer_event);
+    }
 }
 
-static clock_t t;
+int init_timer(struct vm *vm)
+{
+    struct timer *t = vm->timer = calloc(1, sizeof(struct timer));
+    if (!t)
+        return 0;
+
+    if (vm->options.timer_mode == TIMER_WALL_CLOCK)
+    {
+        if (vm->options.timer_period == 0)
+            vm->options.timer_period = TIMER_PERIOD_IN_MS;
+        t->wall_deadline = monotonic_ns() + vm->options.timer_period * 1000000;
+    }
+    else
+    {
+        if (vm->options.timer_period == 0)
+            vm->options.timer_period = TIMER_PERIOD_IN_INSNS;
+        t->virtual_deadline = vm->retired + vm->options.timer_period;
+    }
+
+    /* a replayed run takes its ticks from the event log */
+    if (vm->options.replay_filename)
+        return 1;
+    if (vm->options.timer_mode == TIMER_WALL_CLOCK)
+        sched_at(vm, vm->retired + WALL_CLOCK_CHECK_INTERVAL, timer_event);
+    else
+        sched_at(vm, t->virtual_deadline, timer_event);
+    return 1;
+}
+
+void close_timer(struct vm *vm)
+{
+    free(vm->timer);
+    vm->timer = NULL;
+}
 
-void init_timer(void)
+void wait_for_devices(struct vm *vm)
 {
-    t = clock();
+    struct console *c = vm->console;
+    struct timer *t = vm->timer;
+
+    /* a regular input file is read on this thread, when the guest takes the input */
+    if (c->input_regular && atomic_load_explicit(&c->input_open, memory_order_relaxed))
+        return;
+
+    uint64_t now = monotonic_ns();
+    if (now >= t->wall_deadline)
+        return;
+    uint64_t timeout = (t->wall_deadline - now + 999999) / 1000000;
+
+    /* the guest may be waiting for input in response to its output */
+    flush_output(vm);
+
+    atomic_store_explicit(&c->sleeping, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    struct pollfd pfd[3] = {
+        { .fd = c->notify[0], .events = POLLIN },
+        { .fd = stop_pipe[0], .events = POLLIN },
+        { .fd = net_socket(vm), .events = POLLIN },
+    };
+    if (!atomic_load_explicit(&c->input_pending, memory_order_relaxed) && !stop_signal)
+        poll(pfd, 3, timeout < INT_MAX ? (int) timeout : INT_MAX);
+    atomic_store_explicit(&c->sleeping, 0, memory_order_relaxed);
+
+    if (pfd[0].revents & POLLIN)
+    {
+        char buf[16];
+        ssize_t status = read(c->notify[0], buf, sizeof(buf));
+        (void) status;
+    }
 }
 
-void poll_timer(void)
+uint64_t timer_remaining(struct vm *vm)
 {
-    double elapsed = (double)(clock() - t) / CLOCKS_PER_SEC;
-    if (elapsed > TIMER_PERIOD_IN_SEC)
+    struct timer *t = vm->timer;
+
+    if (vm->options.timer_mode == TIMER_WALL_CLOCK)
     {
-        t = clock();
-        if (PSW_TEST_FLAG(PSW_FLAG_T))
-        {
-            intr = 1;
-            ivtentry = TIMER_TICK_IVTENTRY;
-        }
+        uint64_t now = monotonic_ns();
+        return t->wall_deadline > now ? (t->wall_deadline - now) / 1000000 : 0;
     }
+    return t->virtual_deadline > vm->retired ? t->virtual_deadline - vm->retired : 0;
 }
 
+void restart_devices(struct vm *vm, uint64_t timer_remaining)
+{
+    struct timer *t = vm->timer;
+
+    sched_clear(vm);
+    sched_at(vm, vm->retired + INPUT_POLL_INTERVAL, console_event);
+
+    if (vm->options.timer_mode == TIMER_WALL_CLOCK)
+    {
+        t->wall_deadline = monotonic_ns() + timer_remaining * 1000000;
+        sched_at(vm, vm->retired + WALL_CLOCK_CHECK_INTERVAL, timer_event);
+    }
+    else
+    {
+        t->virtual_deadline = vm->retired + timer_remaining;
+        sched_at(vm, t->virtual_deadline, timer_event);
+    }
+}
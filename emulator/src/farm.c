@@ -0,0 +1,511 @@
+/* File: farm.c */
+/* Parallel batch runner. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Note: non-standard headers, available on POSIX systems */
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "util.h"
+#include "vm.h"
+#include "devices.h"
+#include "control.h"
+#include "snapshot.h"
+#include "farm.h"
+
+/* Job outcomes. */
+enum {
+    JOB_ERROR = 0,         /* the job couldn't be set up or loaded */
+    JOB_HALTED = 1,        /* the CPU halted */
+    JOB_OUT_OF_BUDGET = 2, /* the instruction budget ran out first */
+};
+
+static const char *job_status_name[] = { "error", "halted", "budget" };
+
+/* Comparison of the output with the expected output. */
+enum {
+    OUTPUT_UNCHECKED = 0,
+    OUTPUT_MATCH = 1,
+    OUTPUT_MISMATCH = 2,
+};
+
+static const char *output_name[] = { "-", "match", "mismatch" };
+
+/* One manifest line and its result. */
+struct job {
+    char *exec_filename;
+    char *input_filename;    /* NULL for no input */
+    char *expected_filename; /* NULL if the output isn't checked */
+    uint64_t budget;         /* 0 for no limit */
+
+    int status;
+    uint16_t exit_reg;
+    uint64_t retired;
+    double wall_ms;
+    int output;
+};
+
+/* Jobs [head, tail) of a worker. The owner takes them from the head,
+ * idle workers steal them from the tail. */
+struct deque {
+    pthread_mutex_t lock;
+    size_t head;
+    size_t tail;
+};
+
+#define NO_JOB SIZE_MAX
+
+struct farm {
+    struct job *jobs;
+    size_t njobs;
+    struct deque *deques;
+    int nworkers;
+    const struct vm_options *options;
+    int exit_register;
+};
+
+struct worker {
+    struct farm *farm;
+    int id;
+    pthread_t thread;
+};
+
+/* Function next_field returns a copy of the next whitespace separated field of *line,
+ * NULL if there is none or the field is '-'. *line is advanced past the field. */
+static char *next_field(char **line)
+{
+    char *p = *line;
+    while (isspace((unsigned char) *p))
+        ++p;
+    char *start = p;
+    while (*p && !isspace((unsigned char) *p))
+        ++p;
+    *line = p;
+
+    size_t len = (size_t)(p - start);
+    if (len == 0 || (len == 1 && *start == '-'))
+        return NULL;
+
+    char *field = malloc(len + 1);
+    if (!field)
+        memory_alloc_error("farm", "manifest field", (long)(len + 1));
+    memcpy(field, start, len);
+    field[len] = '\0';
+    return field;
+}
+
+/* Function read_manifest reads all jobs of manifest file fp. Returns 0 on a malformed line. */
+static int read_manifest(FILE *fp, const char *filename, struct job **jobs, size_t *njobs)
+{
+    char line[FARM_MAX_LINE];
+    size_t capacity = 0;
+    int line_no = 0;
+
+    *jobs = NULL;
+    *njobs = 0;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        ++line_no;
+        if (!strchr(line, '\n') && !feof(fp))
+        {
+            fprintf(stderr, "error: %s:%d: line too long\n", filename, line_no);
+            return 0;
+        }
+
+        char *p = line;
+        while (isspace((unsigned char) *p))
+            ++p;
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        struct job job = { 0 };
+        job.exec_filename = next_field(&p);
+        job.input_filename = next_field(&p);
+        char *budget = next_field(&p);
+        job.expected_filename = next_field(&p);
+        char *extra = next_field(&p);
+
+        int valid = job.exec_filename && !extra;
+        if (valid && budget)
+        {
+            char *end;
+            errno = 0;
+            job.budget = strtoull(budget, &end, 0);
+            valid = errno == 0 && *end == '\0' && isdigit((unsigned char) budget[0]);
+        }
+        free(budget);
+        free(extra);
+
+        if (!valid)
+        {
+            fprintf(stderr, "error: %s:%d: expected 'exec_file [input_file [budget [expected_output]]]'\n",
+                    filename, line_no);
+            free(job.exec_filename);
+            free(job.input_filename);
+            free(job.expected_filename);
+            return 0;
+        }
+
+        if (*njobs == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 64;
+            struct job *grown = realloc(*jobs, capacity * sizeof(struct job));
+            if (!grown)
+                memory_alloc_error("farm", "job list", (long)(capacity * sizeof(struct job)));
+            *jobs = grown;
+        }
+        (*jobs)[(*njobs)++] = job;
+    }
+
+    return 1;
+}
+
+static void free_jobs(struct job *jobs, size_t njobs)
+{
+    size_t i;
+    for (i = 0; i < njobs; ++i)
+    {
+        free(jobs[i].exec_filename);
+        free(jobs[i].input_filename);
+        free(jobs[i].expected_filename);
+    }
+    free(jobs);
+}
+
+/* Function compare_output compares the contents of out with file expected_filename. */
+static int compare_output(FILE *out, const char *expected_filename)
+{
+    FILE *expected = fopen(expected_filename, "rb");
+    if (!expected)
+    {
+        write_log(LOG_ERROR, "farm: failed to open file '%s'", expected_filename);
+        return OUTPUT_MISMATCH;
+    }
+
+    rewind(out);
+
+    int result = OUTPUT_MATCH;
+    char a[4096], b[4096];
+    for (;;)
+    {
+        size_t na = fread(a, 1, sizeof(a), out);
+        size_t nb = fread(b, 1, sizeof(b), expected);
+        if (na != nb || memcmp(a, b, na) != 0)
+        {
+            result = OUTPUT_MISMATCH;
+            break;
+        }
+        if (na < sizeof(a))
+            break;
+    }
+
+    fclose(expected);
+    return result;
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1e3 + (double)(now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* Function run_job runs job in a machine of its own, with output captured in a temporary file. */
+static void run_job(const struct farm *farm, struct job *job)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct vm_options options = *farm->options;
+    options.input_fd = -1;
+    options.output_fd = -1;
+    options.max_insns = job->budget;
+
+    FILE *bin = NULL;
+    FILE *out = NULL;
+    struct vm *vm = NULL;
+
+    job->status = JOB_ERROR;
+
+    int snapshot = is_snapshot(job->exec_filename);
+    bin = snapshot ? NULL : fopen(job->exec_filename, "rb");
+    if (!snapshot && !bin)
+    {
+        write_log(LOG_ERROR, "farm: failed to open file '%s'", job->exec_filename);
+        goto done;
+    }
+    if (job->input_filename)
+    {
+        options.input_fd = open(job->input_filename, O_RDONLY);
+        if (options.input_fd < 0)
+        {
+            write_log(LOG_ERROR, "farm: failed to open file '%s'", job->input_filename);
+            goto done;
+        }
+    }
+    out = tmpfile();
+    if (!out)
+    {
+        write_log(LOG_ERROR, "farm: failed to create a temporary output file");
+        goto done;
+    }
+    options.output_fd = fileno(out);
+
+    vm = vm_create(&options);
+    if (!vm || (snapshot ? !restore_snapshot(vm, job->exec_filename) : !run(vm, bin)))
+    {
+        write_log(LOG_ERROR, "farm: failed to run '%s'", job->exec_filename);
+        goto done;
+    }
+    if (snapshot)
+        resume(vm);
+    if (vm->failed)
+    {
+        write_log(LOG_ERROR, "farm: machine of '%s' failed", job->exec_filename);
+        goto done;
+    }
+
+    job->status = vm->out_of_budget ? JOB_OUT_OF_BUDGET : JOB_HALTED;
+    job->exit_reg = (uint16_t) vm->cpu_context.reg[farm->exit_register];
+    job->retired = vm->retired;
+    if (job->expected_filename)
+        job->output = compare_output(out, job->expected_filename);
+
+done:
+    if (vm)
+        vm_destroy(vm);
+    if (out)
+        fclose(out);
+    if (options.input_fd >= 0)
+        close(options.input_fd);
+    if (bin)
+        fclose(bin);
+
+    job->wall_ms = elapsed_ms(&start);
+}
+
+/* Function take removes a job from deque d, from its tail if steal is set. */
+static size_t take(struct deque *d, int steal)
+{
+    size_t job = NO_JOB;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail)
+        job = steal ? --d->tail : d->head++;
+    pthread_mutex_unlock(&d->lock);
+
+    return job;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct farm *farm = w->farm;
+
+    for (;;)
+    {
+        size_t job = take(&farm->deques[w->id], 0);
+
+        /* jobs are never added, so one pass over empty deques means all are taken */
+        int i;
+        for (i = 1; job == NO_JOB && i < farm->nworkers; ++i)
+            job = take(&farm->deques[(w->id + i) % farm->nworkers], 1);
+        if (job == NO_JOB || stop_signal_caught())
+            break; /* jobs not run are reported as errors */
+
+        run_job(farm, &farm->jobs[job]);
+    }
+
+    return NULL;
+}
+
+static void write_csv_field(FILE *fp, const char *s)
+{
+    if (!s)
+    {
+        fputc('-', fp);
+        return;
+    }
+    if (!strpbrk(s, ",\"\r\n"))
+    {
+        fputs(s, fp);
+        return;
+    }
+
+    fputc('"', fp);
+    for (; *s; ++s)
+    {
+        if (*s == '"')
+            fputc('"', fp);
+        fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+static void write_csv(FILE *fp, const struct job *jobs, size_t njobs)
+{
+    fprintf(fp, "exec,input,budget,expected,status,exit_reg,retired,wall_ms,output\n");
+
+    size_t i;
+    for (i = 0; i < njobs; ++i)
+    {
+        const struct job *job = &jobs[i];
+        write_csv_field(fp, job->exec_filename);
+        fputc(',', fp);
+        write_csv_field(fp, job->input_filename);
+        fprintf(fp, ",%llu,", (unsigned long long) job->budget);
+        write_csv_field(fp, job->expected_filename);
+        fprintf(fp, ",%s,%u,%llu,%.3f,%s\n", job_status_name[job->status], (unsigned) job->exit_reg,
+                (unsigned long long) job->retired, job->wall_ms, output_name[job->output]);
+    }
+}
+
+static void write_json_string(FILE *fp, const char *s)
+{
+    if (!s)
+    {
+        fputs("null", fp);
+        return;
+    }
+
+    fputc('"', fp);
+    for (; *s; ++s)
+    {
+        unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+static void write_json(FILE *fp, const struct job *jobs, size_t njobs)
+{
+    fputs("[\n", fp);
+
+    size_t i;
+    for (i = 0; i < njobs; ++i)
+    {
+        const struct job *job = &jobs[i];
+        fputs("  { \"exec\": ", fp);
+        write_json_string(fp, job->exec_filename);
+        fputs(", \"input\": ", fp);
+        write_json_string(fp, job->input_filename);
+        fprintf(fp, ", \"budget\": %llu, \"expected\": ", (unsigned long long) job->budget);
+        write_json_string(fp, job->expected_filename);
+        fprintf(fp, ", \"status\": \"%s\", \"exit_reg\": %u, \"retired\": %llu, \"wall_ms\": %.3f, \"output\": ",
+                job_status_name[job->status], (unsigned) job->exit_reg,
+                (unsigned long long) job->retired, job->wall_ms);
+        write_json_string(fp, job->output == OUTPUT_UNCHECKED ? NULL : output_name[job->output]);
+        fputs(i + 1 < njobs ? " },\n" : " }\n", fp);
+    }
+
+    fputs("]\n", fp);
+}
+
+static int ends_with(const char *s, const char *suffix)
+{
+    size_t len = strlen(s), suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+int run_farm(const char *manifest_filename, const char *results_filename, int nworkers,
+             const struct vm_options *options, int exit_register)
+{
+    FILE *manifest = fopen(manifest_filename, "r");
+    if (!manifest)
+    {
+        fprintf(stderr, "error: failed to open file '%s'\n", manifest_filename);
+        return EXIT_FAILURE;
+    }
+
+    struct farm farm = { .options = options, .exit_register = exit_register };
+    int valid = read_manifest(manifest, manifest_filename, &farm.jobs, &farm.njobs);
+    fclose(manifest);
+    if (!valid)
+    {
+        free_jobs(farm.jobs, farm.njobs);
+        return EXIT_FAILURE;
+    }
+
+    if (nworkers <= 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        nworkers = online > 0 ? (int) online : 1;
+    }
+    if (nworkers > FARM_MAX_WORKERS)
+        nworkers = FARM_MAX_WORKERS;
+    if ((size_t) nworkers > farm.njobs)
+        nworkers = farm.njobs > 0 ? (int) farm.njobs : 1;
+    farm.nworkers = nworkers;
+
+    /* deal the jobs out in contiguous ranges, one per worker */
+    struct deque deques[FARM_MAX_WORKERS];
+    struct worker workers[FARM_MAX_WORKERS];
+    farm.deques = deques;
+    int i;
+    for (i = 0; i < nworkers; ++i)
+    {
+        pthread_mutex_init(&deques[i].lock, NULL);
+        deques[i].head = farm.njobs * (size_t) i / (size_t) nworkers;
+        deques[i].tail = farm.njobs * (size_t)(i + 1) / (size_t) nworkers;
+    }
+
+    write_log(LOG_NORMAL, "farm: %zu jobs on %d workers", farm.njobs, nworkers);
+
+    /* worker 0 is the calling thread */
+    int started;
+    for (started = 1; started < nworkers; ++started)
+    {
+        workers[started] = (struct worker) { .farm = &farm, .id = started };
+        if (pthread_create(&workers[started].thread, NULL, worker_main, &workers[started]) != 0)
+        {
+            write_log(LOG_ERROR, "farm: failed to start worker %d", started);
+            break; /* the remaining deques are stolen from */
+        }
+    }
+    workers[0] = (struct worker) { .farm = &farm, .id = 0 };
+    worker_main(&workers[0]);
+    for (i = 1; i < started; ++i)
+        pthread_join(workers[i].thread, NULL);
+    for (i = 0; i < nworkers; ++i)
+        pthread_mutex_destroy(&deques[i].lock);
+
+    FILE *results = results_filename ? fopen(results_filename, "w") : stdout;
+    if (!results)
+    {
+        fprintf(stderr, "error: failed to open file '%s'\n", results_filename);
+        free_jobs(farm.jobs, farm.njobs);
+        return EXIT_FAILURE;
+    }
+    if (results_filename && ends_with(results_filename, ".json"))
+        write_json(results, farm.jobs, farm.njobs);
+    else
+        write_csv(results, farm.jobs, farm.njobs);
+    if (results != stdout)
+        fclose(results);
+
+    int status = EXIT_SUCCESS;
+    size_t j;
+    for (j = 0; j < farm.njobs; ++j)
+        if (farm.jobs[j].status != JOB_HALTED || farm.jobs[j].output == OUTPUT_MISMATCH)
+            status = EXIT_FAILURE;
+
+    free_jobs(farm.jobs, farm.njobs);
+    return status;
+}
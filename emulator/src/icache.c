@@ -0,0 +1,200 @@
+/* File: icache.c */
+/* Predecoded instruction cache. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "constants.h"
+#include "obj_format.h"
+#include "icache.h"
+
+#define ICACHE_SIZE MEM_SIZE /* one entry per address */
+
+int init_icache(struct vm *vm)
+{
+    vm->icache = calloc(ICACHE_SIZE, sizeof(struct icache_entry));
+    vm->icache_code_map = calloc(ICACHE_SIZE, sizeof(uint8_t));
+    return vm->icache && vm->icache_code_map;
+}
+
+void close_icache(struct vm *vm)
+{
+    free(vm->icache);
+    free(vm->icache_code_map);
+    vm->icache = NULL;
+    vm->icache_code_map = NULL;
+}
+
+static int resolve_kind(int address_mode, int reg_idx)
+{
+    switch (address_mode)
+    {
+    case IMMED:
+        return (reg_idx == 0x7) ? OPND_PSW : OPND_IMMED;
+    case REGDIR:
+        return OPND_REG;
+    case MEMDIR:
+        return OPND_MEM;
+    case REGINDDISP:
+    default:
+        return OPND_REGIND;
+    }
+}
+
+/* Function is_branch checks if e is JMP<cond> with an immediate operand. */
+static int is_branch(const struct icache_entry *e)
+{
+    return (e->opcode == MOV || e->opcode == ADD) && e->kind[0] == OPND_REG && e->reg[0] == 7
+        && e->kind[1] == OPND_IMMED;
+}
+
+/* Function decode_entry decodes the instruction at address pc into its cache entry, unfused. */
+static struct icache_entry *decode_entry(struct vm *vm, uint16_t pc)
+{
+    struct icache_entry *entry = &vm->icache[pc];
+
+    int16_t ir0 = vm->mem[pc] << 8;
+    ir0 |= vm->mem[(uint16_t)(pc + 1)];
+
+    entry->ir0 = ir0;
+    entry->cond = (ir0 >> 14) & 0x3;
+    entry->opcode = (ir0 >> 10) & 0xf;
+    entry->reg[0] = (ir0 >> 5) & 0x7;
+    entry->reg[1] = ir0 & 0x7;
+    entry->kind[0] = resolve_kind((ir0 >> 8) & 0x3, entry->reg[0]);
+    entry->kind[1] = resolve_kind((ir0 >> 3) & 0x3, entry->reg[1]);
+
+    /* any operand other than PSW and REGDIR needs the second instruction word */
+    int long_instruction = 0;
+    long_instruction |= (entry->kind[0] != OPND_PSW && entry->kind[0] != OPND_REG);
+    long_instruction |= (entry->kind[1] != OPND_PSW && entry->kind[1] != OPND_REG);
+    if (long_instruction)
+    {
+        entry->len = INSTRUCTION_SIZE_LONG;
+        entry->ir1 = vm->mem[(uint16_t)(pc + 2)];
+        entry->ir1 |= vm->mem[(uint16_t)(pc + 3)] << 8;
+    }
+    else
+    {
+        entry->len = INSTRUCTION_SIZE;
+        entry->ir1 = 0;
+    }
+
+    entry->illegal = (entry->kind[0] == OPND_IMMED && entry->opcode != PUSH && entry->opcode != IRET);
+    entry->handler = entry->illegal ? ICACHE_HANDLER_ILLEGAL : ICACHE_HANDLER(entry->opcode, entry->kind[0]);
+    if (is_branch(entry))
+        entry->handler = ICACHE_JCC;
+
+    int i;
+    entry->span = entry->len;
+    for (i = 0; i < entry->span; ++i)
+        ++vm->icache_code_map[(uint16_t)(pc + i)];
+    entry->valid = 1;
+
+    return entry;
+}
+
+/* Function is_reg_op checks if e is the unconditional instruction opcode
+ * with a register other than R7 as its destination. */
+static int is_reg_op(const struct icache_entry *e, int opcode)
+{
+    return e->opcode == opcode && e->cond == AL && e->kind[0] == OPND_REG && e->reg[0] != 7;
+}
+
+static int is_ret(const struct icache_entry *e)
+{
+    return e->opcode == POP && e->cond == AL && e->kind[0] == OPND_REG && e->reg[0] == 7;
+}
+
+static int is_output_store(const struct icache_entry *e)
+{
+    return e->opcode == MOV && e->cond == AL && e->kind[0] == OPND_MEM
+        && (uint16_t) e->ir1 == OUTPUT_DEVICE_ADDRESS && e->kind[1] == OPND_REG;
+}
+
+/* Function following returns the entry of the instruction after e, at address pc. */
+static struct icache_entry *following(struct vm *vm, const struct icache_entry *e, uint16_t pc)
+{
+    uint16_t next = (uint16_t)(pc + e->len);
+    struct icache_entry *entry = &vm->icache[next];
+    return entry->valid ? entry : decode_entry(vm, next);
+}
+
+/* Function fuse gives entry, at address pc, the handler of the sequence it starts, if any,
+ * and extends its span over the whole sequence. See icache.h for the sequences. */
+static void fuse(struct vm *vm, struct icache_entry *entry, uint16_t pc)
+{
+    if (!is_reg_op(entry, MOV) && !is_reg_op(entry, CMP) && !is_reg_op(entry, PUSH) && !is_reg_op(entry, POP))
+        return;
+
+    const struct icache_entry *second = following(vm, entry, pc);
+    const struct icache_entry *third;
+    int handler = -1;
+    int span = entry->len + second->len;
+
+    if (entry->opcode == MOV && is_reg_op(second, CMP)
+        && is_branch(third = following(vm, second, (uint16_t)(pc + entry->len))))
+    {
+        handler = ICACHE_FUSED_MOV_CMP_JCC;
+        span += third->len;
+    }
+    else if (entry->opcode == CMP && is_branch(second))
+        handler = ICACHE_FUSED_CMP_JCC;
+    else if (entry->opcode == PUSH && is_reg_op(second, PUSH))
+        handler = ICACHE_FUSED_PUSH_PUSH;
+    else if (entry->opcode == POP && is_reg_op(second, POP))
+        handler = ICACHE_FUSED_POP_POP;
+    else if (entry->opcode == POP && is_ret(second))
+        handler = ICACHE_FUSED_POP_RET;
+    else if (entry->opcode == MOV && is_output_store(second))
+        handler = ICACHE_FUSED_MOV_OUT;
+    else if (entry->opcode == MOV && is_reg_op(second, MOV))
+        handler = ICACHE_FUSED_MOV_MOV;
+    if (handler < 0)
+        return;
+
+    int i;
+    for (i = entry->span; i < span; ++i)
+        ++vm->icache_code_map[(uint16_t)(pc + i)];
+    entry->span = (uint8_t) span;
+    entry->handler = (uint8_t) handler;
+}
+
+struct icache_entry *predecode(struct vm *vm, uint16_t pc)
+{
+    struct icache_entry *entry = decode_entry(vm, pc);
+    if (vm->icache_fusion)
+        fuse(vm, entry, pc);
+    return entry;
+}
+
+static void drop(struct vm *vm, struct icache_entry *entry, uint16_t pc)
+{
+    int i;
+    for (i = 0; i < entry->span; ++i)
+        --vm->icache_code_map[(uint16_t)(pc + i)];
+    entry->valid = 0;
+    ++vm->icache_generation;
+}
+
+void icache_invalidate(struct vm *vm, uint16_t addr)
+{
+    /* an entry covering addr starts at most ICACHE_MAX_SPAN - 1 bytes before it */
+    int i;
+    for (i = 0; i < ICACHE_MAX_SPAN; ++i)
+    {
+        uint16_t pc = (uint16_t)(addr - i);
+        struct icache_entry *entry = &vm->icache[pc];
+        if (entry->valid && i < entry->span)
+            drop(vm, entry, pc);
+    }
+}
+
+void icache_flush(struct vm *vm)
+{
+    memset(vm->icache, 0, ICACHE_SIZE * sizeof(struct icache_entry));
+    memset(vm->icache_code_map, 0, ICACHE_SIZE * sizeof(uint8_t));
+    ++vm->icache_generation;
+}
@@ -0,0 +1,111 @@
+/* File: idle.c */
+/* Idle loop detection and fast-forward. */
+
+#include <stdint.h>
+
+#include "vm.h"
+#include "constants.h"
+#include "icache.h"
+#include "devices.h"
+#include "block.h"
+#include "net.h"
+#include "profile.h"
+#include "mmio.h"
+#include "idle.h"
+
+/* Function reads_reg checks if operand kind kind with register field reg reads a register of mask regs. */
+static int reads_reg(int kind, int reg, unsigned regs)
+{
+    return (kind == OPND_REG || kind == OPND_REGIND) && (regs & (1u << reg));
+}
+
+/* Function may_touch_mmio checks if operand i of e, at address addr, may access a device register. */
+static int may_touch_mmio(const struct icache_entry *e, int i, uint16_t addr)
+{
+    if (e->kind[i] == OPND_MEM)
+        return mmio_touches((uint16_t) e->ir1);
+    if (e->kind[i] == OPND_REGIND)
+        return e->reg[i] != 7 || mmio_touches((uint16_t)(addr + e->len + e->ir1));
+    return 0;
+}
+
+int idle_loop(struct vm *vm, uint16_t pc)
+{
+    const struct icache_entry *branch = icache_lookup(vm, pc);
+    if (branch->illegal || (branch->opcode != MOV && branch->opcode != ADD)
+        || branch->kind[0] != OPND_REG || branch->reg[0] != 7 || branch->kind[1] != OPND_IMMED)
+        return 0;
+
+    uint16_t target = branch->opcode == MOV ? (uint16_t) branch->ir1 : (uint16_t)(pc + branch->len + branch->ir1);
+    if (target > pc)
+        return 0;
+
+    /* registers the loop writes, then whether its MOVs read any of them */
+    unsigned written = 0;
+    int n = 1;
+    uint16_t addr;
+    for (addr = target; addr != pc; addr = (uint16_t)(addr + icache_lookup(vm, addr)->len), ++n)
+    {
+        const struct icache_entry *e = icache_lookup(vm, addr);
+        if (n == IDLE_MAX_INSNS || addr > pc || e->illegal || e->cond != AL
+            || may_touch_mmio(e, 0, addr) || may_touch_mmio(e, 1, addr))
+            return 0;
+        if (e->opcode == MOV && e->kind[0] == OPND_REG && e->reg[0] != 7 && e->kind[1] != OPND_PSW)
+            written |= 1u << e->reg[0];
+        else if (e->opcode != CMP && e->opcode != TEST)
+            return 0;
+    }
+    for (addr = target; addr != pc; addr = (uint16_t)(addr + icache_lookup(vm, addr)->len))
+    {
+        const struct icache_entry *e = icache_lookup(vm, addr);
+        if (e->opcode == MOV && reads_reg(e->kind[1], e->reg[1], written))
+            return 0;
+    }
+    return n;
+}
+
+/* Function skip retires count iterations of the idle loop of n instructions closed by the branch at pc. */
+static void skip(struct vm *vm, uint16_t pc, int n, uint64_t count)
+{
+    vm->retired += count * (uint64_t) n;
+
+    struct profile *prof = vm->profile;
+    if (!prof)
+        return;
+    const struct icache_entry *branch = icache_lookup(vm, pc);
+    uint16_t addr = branch->opcode == MOV ? (uint16_t) branch->ir1 : (uint16_t)(pc + branch->len + branch->ir1);
+    for (; n > 0; addr = (uint16_t)(addr + icache_lookup(vm, addr)->len), --n)
+        prof->count[addr] += count;
+}
+
+void idle_check(struct vm *vm, uint16_t pc)
+{
+    if (pc != vm->idle_pc || vm->idle_generation != vm->icache_generation)
+    {
+        vm->idle_pc = pc;
+        vm->idle_generation = vm->icache_generation;
+        vm->idle_insns = idle_loop(vm, pc);
+        vm->idle_retired = vm->retired;
+        return;
+    }
+
+    /* a full iteration ran since the last jump, without interrupts */
+    uint64_t last = vm->idle_retired;
+    int n = vm->idle_insns;
+    vm->idle_retired = vm->retired;
+    if (vm->retired - last != (uint64_t) n || vm->intr || PSW_TEST_FLAG(vm, PSW_FLAG_I) || vm->trace)
+        return;
+
+    if (vm->options.timer_mode == TIMER_WALL_CLOCK && !vm->options.max_insns && !vm->options.replay_filename
+        && !block_pending(vm) && !net_pending(vm))
+        wait_for_devices(vm);
+
+    /* the branch retires next, then whole iterations up to the next event */
+    if (vm->sched_next == UINT64_MAX || vm->sched_next <= vm->retired + 1)
+        return;
+    uint64_t count = (vm->sched_next - vm->retired - 1) / (uint64_t) n;
+    if (count == 0)
+        return;
+    skip(vm, pc, n, count);
+    vm->idle_retired = vm->retired;
+}
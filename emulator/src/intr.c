@@ -1,40 +1,41 @@
 /* File: intr.c */
 /* CPU interrupt block. */
 
-#include "cpu.h"
-#include "mem.h"
+#include "vm.h"
 #include "exec.h"
+#include "alu.h"
 #include "intr.h"
+#include "callgraph.h"
 
-int intr;
-
-void push(int16_t);
-void pop(int16_t *);
-
-void interrupt(void)
+void interrupt(struct vm *vm)
 {
-    if (!intr)
+    if (!vm->intr)
         return;
 
-    if (PSW_TEST_FLAG(PSW_FLAG_I))
+    if (PSW_TEST_FLAG(vm, PSW_FLAG_I))
         return;
 
-    intr = 0;
+    vm->intr = 0;
 
-    push(cpu_context.reg[7]);
-    push(cpu_context.psw);
+    psw_sync(vm);
+    push(vm, vm->cpu_context.reg[7]);
+    push(vm, vm->cpu_context.psw);
 
-    PSW_SET_FLAG(PSW_FLAG_I);
+    PSW_SET_FLAG(vm, PSW_FLAG_I);
 
-    ivtentry &= 0x7; /* look at the 3 least significant bits (8 entries in IVT) */
-    uint16_t intr_routine_addr = ivtp + ivtentry * IVTENTRY_SIZE;
-    cpu_context.reg[7] = (int16_t) *(mem + intr_routine_addr);
-    cpu_context.reg[7] |= (int16_t) *(mem + intr_routine_addr + 1) << 8;
+    vm->ivtentry &= 0x7; /* look at the 3 least significant bits (8 entries in IVT) */
+    uint16_t intr_routine_addr = vm->ivtp + vm->ivtentry * IVTENTRY_SIZE;
+    vm->cpu_context.reg[7] = (int16_t) *(vm->mem + intr_routine_addr);
+    vm->cpu_context.reg[7] |= (int16_t) *(vm->mem + intr_routine_addr + 1) << 8;
 
-    if (cpu_context.reg[7] == 0) /* null pointer to interrupt routine */
+    if (vm->cpu_context.reg[7] == 0) /* null pointer to interrupt routine */
+    {
+        pop(vm, &vm->cpu_context.psw);
+        pop(vm, &vm->cpu_context.reg[7]);
+    }
+    else if (vm->callgraph)
     {
-        pop(&cpu_context.psw);
-        pop(&cpu_context.reg[7]);
+        callgraph_interrupt(vm);
     }
 }
 
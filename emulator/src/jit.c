@@ -0,0 +1,734 @@
+/* File: jit.c */
+/* Basic-block translator from guest code to x86-64. */
+
+/* Note: MAP_ANONYMOUS is not part of ISO C nor of POSIX.1-2008 */
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "vm.h"
+#include "constants.h"
+#include "obj_format.h"
+#include "icache.h"
+#include "alu.h"
+#include "fetch.h"
+#include "decode.h"
+#include "exec.h"
+#include "intr.h"
+#include "devices.h"
+#include "sched.h"
+#include "threaded.h"
+#include "profile.h"
+#include "idle.h"
+#include "mmio.h"
+#include "jit.h"
+
+#if defined(__x86_64__)
+
+/* Note: non-standard header, available on POSIX systems */
+#include <sys/mman.h>
+
+/* Host register assignment inside translated code:
+ *   rbx - &vm->cpu_context
+ *   r12 - vm->mem
+ *   r13 - &jit->state
+ * Everything else is scratch; guest registers live in vm->cpu_context. */
+
+/* Offsets into struct cpu_context_t. */
+#define OFF_REG(r) (2 * (r))
+#define OFF_PC OFF_REG(7)
+#define OFF_PSW offsetof(struct cpu_context_t, psw)
+#define OFF_FLAGS_A offsetof(struct cpu_context_t, flags.a)
+#define OFF_FLAGS_B offsetof(struct cpu_context_t, flags.b)
+#define OFF_FLAGS_RES offsetof(struct cpu_context_t, flags.res)
+#define OFF_FLAGS_ZN offsetof(struct cpu_context_t, flags.zn)
+#define OFF_FLAGS_CO offsetof(struct cpu_context_t, flags.co)
+
+/* State shared between the dispatcher and translated code. */
+struct jit_state {
+    int32_t budget;               /* instructions left until the next scheduled event */
+    int32_t unused;
+    unsigned char *chain_site;    /* jmp to patch with the block at the new PC */
+};
+
+/* Translator of one machine. The state comes first so that r13 points to both. */
+struct jit {
+    struct jit_state state;
+    int32_t entry_budget;         /* state.budget when the dispatcher entered translated code */
+    struct vm *vm;
+    unsigned char *code_buf;
+    unsigned char *code_ptr;
+    unsigned char *code_start;    /* first byte after the stubs */
+    unsigned char *exit_stub;
+    void (*enter)(struct cpu_context_t *, uint8_t *, struct jit_state *, unsigned char *);
+    unsigned char *block_map[UINT16_MAX + 1];
+    unsigned generation;
+};
+
+/* Largest host code emitted for one block, profile counters included, with room to spare. */
+#define JIT_MAX_BLOCK_CODE (JIT_MAX_BLOCK_INSNS * 192 + 256)
+
+/* Emitter. */
+
+static void emit(struct jit *jit, const unsigned char *bytes, size_t n)
+{
+    memcpy(jit->code_ptr, bytes, n);
+    jit->code_ptr += n;
+}
+
+#define EMIT(...) do { const unsigned char b_[] = { __VA_ARGS__ }; emit(jit, b_, sizeof(b_)); } while (0)
+
+static void emit8(struct jit *jit, uint8_t v)
+{
+    *jit->code_ptr++ = v;
+}
+
+static void emit16(struct jit *jit, uint16_t v)
+{
+    memcpy(jit->code_ptr, &v, 2);
+    jit->code_ptr += 2;
+}
+
+static void emit32(struct jit *jit, uint32_t v)
+{
+    memcpy(jit->code_ptr, &v, 4);
+    jit->code_ptr += 4;
+}
+
+static void emit64(struct jit *jit, uint64_t v)
+{
+    memcpy(jit->code_ptr, &v, 8);
+    jit->code_ptr += 8;
+}
+
+static void patch_rel32(unsigned char *rel, const unsigned char *target)
+{
+    int32_t disp = (int32_t)(target - (rel + 4));
+    memcpy(rel, &disp, 4);
+}
+
+/* Function emit_jcc emits a conditional near jump and returns its displacement field. */
+static unsigned char *emit_jcc(struct jit *jit, uint8_t cc, const unsigned char *target)
+{
+    EMIT(0x0f, cc);
+    unsigned char *rel = jit->code_ptr;
+    emit32(jit, 0);
+    if (target)
+        patch_rel32(rel, target);
+    return rel;
+}
+
+static unsigned char *emit_jmp(struct jit *jit, const unsigned char *target)
+{
+    emit8(jit, 0xe9);
+    unsigned char *rel = jit->code_ptr;
+    emit32(jit, 0);
+    if (target)
+        patch_rel32(rel, target);
+    return rel;
+}
+
+#define JCC_JB  0x82
+#define JCC_JE  0x84
+#define JCC_JNE 0x85
+#define JCC_JLE 0x8e
+
+/* mov word [rbx + off], imm16 */
+static void emit_store_imm16(struct jit *jit, uint8_t off, uint16_t v)
+{
+    EMIT(0x66, 0xc7, 0x43, off);
+    emit16(jit, v);
+}
+
+/* Function emit_load_src loads the source operand of e into ecx. */
+static void emit_load_src(struct jit *jit, const struct icache_entry *e, uint16_t next)
+{
+    switch (e->kind[1])
+    {
+    case OPND_IMMED:
+        emit8(jit, 0xb9);                       /* mov ecx, imm32 */
+        emit32(jit, (uint16_t) e->ir1);
+        break;
+    case OPND_PSW:
+        EMIT(0x0f, 0xb7, 0x4b, OFF_PSW);   /* movzx ecx, word [rbx + psw] */
+        break;
+    case OPND_REG:
+        if (e->reg[1] == 7)
+        {
+            emit8(jit, 0xb9);                   /* mov ecx, pc */
+            emit32(jit, next);
+        }
+        else
+        {
+            EMIT(0x0f, 0xb7, 0x4b, OFF_REG(e->reg[1])); /* movzx ecx, word [rbx + reg] */
+        }
+        break;
+    case OPND_MEM:
+        EMIT(0x41, 0x0f, 0xb7, 0x8c, 0x24); /* movzx ecx, word [r12 + addr] */
+        emit32(jit, (uint16_t) e->ir1);
+        break;
+    case OPND_REGIND:
+        if (e->reg[1] == 7)
+        {
+            EMIT(0x41, 0x0f, 0xb7, 0x8c, 0x24); /* movzx ecx, word [r12 + pc + disp] */
+            emit32(jit, (uint16_t)(next + e->ir1));
+        }
+        else
+        {
+            EMIT(0x0f, 0xb7, 0x53, OFF_REG(e->reg[1]), /* movzx edx, word [rbx + reg] */
+                 0x81, 0xc2);                          /* add edx, disp */
+            emit32(jit, (uint16_t) e->ir1);
+            EMIT(0x0f, 0xb7, 0xd2,                     /* movzx edx, dx */
+                 0x81, 0xfa);                          /* cmp edx, MMIO_BASE - 1 */
+            emit32(jit, MMIO_BASE - 1);
+            unsigned char *memory = emit_jcc(jit, JCC_JB, NULL);
+            EMIT(0x52, 0x52);                          /* push rdx, twice to keep rsp aligned */
+            EMIT(0x48, 0xbf);                          /* mov rdi, vm */
+            emit64(jit, (uint64_t)(uintptr_t) jit->vm);
+            EMIT(0x89, 0xd6);                          /* mov esi, edx */
+            EMIT(0x48, 0xb8);                          /* mov rax, mmio_dispatch_read */
+            emit64(jit, (uint64_t)(uintptr_t) mmio_dispatch_read);
+            EMIT(0xff, 0xd0,                           /* call rax */
+                 0x5a, 0x5a);                          /* pop rdx, twice */
+            patch_rel32(memory, jit->code_ptr);
+            EMIT(0x41, 0x0f, 0xb7, 0x0c, 0x14);        /* movzx ecx, word [r12 + rdx] */
+        }
+        break;
+    }
+}
+
+/* Function can_inline checks if e, whose next instruction is at address next,
+ * is translated into host instructions rather than into a call to jit_step. */
+static int can_inline(const struct icache_entry *e, uint16_t next)
+{
+    /* a PSW source needs the pending flags applied first */
+    if (e->illegal || e->kind[0] != OPND_REG || e->reg[0] == 7 || e->kind[1] == OPND_PSW)
+        return 0;
+    /* jit_step reads device register sources; emit_load_src checks addresses known at run time */
+    if ((e->kind[1] == OPND_MEM && mmio_touches((uint16_t) e->ir1))
+        || (e->kind[1] == OPND_REGIND && e->reg[1] == 7 && mmio_touches((uint16_t)(next + e->ir1))))
+        return 0;
+
+    switch (e->opcode)
+    {
+    case ADD:
+    case SUB:
+    case MOV:
+    case CMP:
+    case AND:
+    case OR:
+    case TEST:
+    case NOT:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Function emit_record_flags records the result in ax as the source of Z and N,
+ * and for ADD/SUB/CMP the operands saved by emit_inline as the source of C and O. */
+static void emit_record_flags(struct jit *jit, int co)
+{
+    EMIT(0x66, 0x89, 0x43, OFF_FLAGS_RES);     /* mov word [rbx + flags.res], ax */
+    if (co == FLAGS_CO_NONE)
+    {
+        EMIT(0xc6, 0x43, OFF_FLAGS_ZN, 1);     /* mov byte [rbx + flags.zn], 1 */
+    }
+    else
+    {
+        emit_store_imm16(jit, OFF_FLAGS_ZN, (uint16_t)(co << 8 | 1)); /* flags.zn = 1, flags.co = co */
+    }
+}
+
+static void emit_inline(struct jit *jit, const struct icache_entry *e, uint16_t next)
+{
+    uint8_t dst = OFF_REG(e->reg[0]);
+    int co = FLAGS_CO_NONE;
+
+    if (e->opcode != NOT)
+        emit_load_src(jit, e, next);
+    if (e->opcode != MOV)
+        EMIT(0x0f, 0xb7, 0x43, dst);           /* movzx eax, word [rbx + dst] */
+
+    switch (e->opcode)
+    {
+    case MOV:
+        EMIT(0x89, 0xc8);                      /* mov eax, ecx */
+        break;
+    case ADD:
+    case SUB:
+    case CMP:
+        EMIT(0x66, 0x89, 0x43, OFF_FLAGS_A,    /* mov word [rbx + flags.a], ax */
+             0x66, 0x89, 0x4b, OFF_FLAGS_B);   /* mov word [rbx + flags.b], cx */
+        if (e->opcode == ADD)
+        {
+            EMIT(0x66, 0x01, 0xc8);            /* add ax, cx */
+            co = FLAGS_CO_ADD;
+        }
+        else
+        {
+            EMIT(0x66, 0x29, 0xc8);            /* sub ax, cx */
+            co = FLAGS_CO_SUB;
+        }
+        break;
+    case AND:
+    case TEST:
+        EMIT(0x66, 0x21, 0xc8);                /* and ax, cx */
+        break;
+    case OR:
+        EMIT(0x66, 0x09, 0xc8);                /* or ax, cx */
+        break;
+    case NOT:
+        EMIT(0x66, 0xf7, 0xd0);                /* not ax */
+        break;
+    }
+
+    if (e->opcode != CMP && e->opcode != TEST)
+        EMIT(0x66, 0x89, 0x43, dst);           /* mov word [rbx + dst], ax */
+
+    emit_record_flags(jit, co);
+}
+
+/* Function jit_step executes one instruction, the ninsns-th of its block, the way
+ * the interpreter does. Returns nonzero if the translated code has to return to the dispatcher. */
+static int jit_step(struct vm *vm, struct icache_entry *e, int32_t ninsns)
+{
+    vm->fetched = e;
+    vm->ir0 = e->ir0;
+    if (e->len == INSTRUCTION_SIZE_LONG)
+        vm->ir1 = e->ir1;
+
+    /* the dispatcher counts retired instructions per run of blocks;
+     * while the instruction executes, the count is exact as in the interpreter */
+    struct jit *jit = vm->jit;
+    uint64_t retired = vm->retired;
+    vm->retired += (uint64_t)(jit->entry_budget - jit->state.budget) + (uint64_t)(ninsns - 1);
+
+    decode(vm);
+    if (!ILLEGAL_INSTRUCTION(vm))
+        execute(vm);
+
+    vm->retired = retired;
+
+    return (vm->intr && !PSW_TEST_FLAG(vm, PSW_FLAG_I)) || PSW_TEST_FLAG(vm, PSW_FLAG_H)
+        || jit->generation != vm->icache_generation;
+}
+
+/* Function emit_step emits a call to jit_step for e, the ninsns-th instruction of the block. */
+static void emit_step(struct jit *jit, const struct icache_entry *e, uint16_t next, int ninsns)
+{
+    emit_store_imm16(jit, OFF_PC, next);
+    EMIT(0x48, 0xbf);                      /* mov rdi, vm */
+    emit64(jit, (uint64_t)(uintptr_t) jit->vm);
+    EMIT(0x48, 0xbe);                      /* mov rsi, e */
+    emit64(jit, (uint64_t)(uintptr_t) e);
+    emit8(jit, 0xba);                      /* mov edx, ninsns */
+    emit32(jit, ninsns);
+    EMIT(0x48, 0xb8);                      /* mov rax, jit_step */
+    emit64(jit, (uint64_t)(uintptr_t) jit_step);
+    EMIT(0xff, 0xd0,                       /* call rax */
+         0x85, 0xc0);                      /* test eax, eax */
+    unsigned char *cont = emit_jcc(jit, JCC_JE, NULL);
+    EMIT(0x41, 0x81, 0x6d, 0x00);          /* sub dword [r13 + budget], ninsns */
+    emit32(jit, ninsns);
+    emit_jmp(jit, jit->exit_stub);
+    patch_rel32(cont, jit->code_ptr);
+}
+
+/* Function jit_idle runs idle_branch for the branch at pc, the ninsns-th instruction of its block,
+ * and takes the instructions it skips from the budget. */
+static void jit_idle(struct vm *vm, uint16_t pc, int32_t ninsns)
+{
+    struct jit *jit = vm->jit;
+    uint64_t retired = vm->retired;
+    vm->retired += (uint64_t)(jit->entry_budget - jit->state.budget) + (uint64_t)(ninsns - 1);
+
+    uint64_t before = vm->retired;
+    idle_branch(vm, pc);
+    jit->state.budget -= (int32_t)(vm->retired - before);
+
+    vm->retired = retired;
+}
+
+/* Function emit_idle emits a call to jit_idle for the branch at pc that closes
+ * an idle loop, the whole block of ninsns instructions. */
+static void emit_idle(struct jit *jit, uint16_t pc, int ninsns)
+{
+    EMIT(0x48, 0xbf);                      /* mov rdi, vm */
+    emit64(jit, (uint64_t)(uintptr_t) jit->vm);
+    emit8(jit, 0xbe);                      /* mov esi, pc */
+    emit32(jit, pc);
+    emit8(jit, 0xba);                      /* mov edx, ninsns */
+    emit32(jit, ninsns);
+    EMIT(0x48, 0xb8);                      /* mov rax, jit_idle */
+    emit64(jit, (uint64_t)(uintptr_t) jit_idle);
+    EMIT(0xff, 0xd0);                      /* call rax */
+}
+
+/* Function emit_exit_checks leaves the block if the poll budget is spent
+ * or an interrupt can be accepted. */
+static void emit_exit_checks(struct jit *jit, int ninsns)
+{
+    EMIT(0x41, 0x81, 0x6d, 0x00);          /* sub dword [r13 + budget], ninsns */
+    emit32(jit, ninsns);
+    emit_jcc(jit, JCC_JLE, jit->exit_stub);
+    EMIT(0x48, 0xb8);                      /* mov rax, &vm->intr */
+    emit64(jit, (uint64_t)(uintptr_t) &jit->vm->intr);
+    EMIT(0x83, 0x38, 0x00);                /* cmp dword [rax], 0 */
+    unsigned char *none = emit_jcc(jit, JCC_JE, NULL);
+    EMIT(0xf6, 0x43, OFF_PSW + 1, 0x80);   /* test byte [rbx + psw + 1], I */
+    emit_jcc(jit, JCC_JE, jit->exit_stub);
+    patch_rel32(none, jit->code_ptr);
+}
+
+/* Function emit_static_exit ends the block with a jump to guest address target,
+ * which is patched into a direct jump to the target block once it is translated. */
+static void emit_static_exit(struct jit *jit, uint16_t target, int ninsns)
+{
+    emit_store_imm16(jit, OFF_PC, target);
+    emit_exit_checks(jit, ninsns);
+    unsigned char *site = jit->code_ptr;
+    emit_jmp(jit, jit->code_ptr + 5);
+    EMIT(0x48, 0xb8);                      /* mov rax, site */
+    emit64(jit, (uint64_t)(uintptr_t) site);
+    EMIT(0x49, 0x89, 0x45,                 /* mov [r13 + chain_site], rax */
+         offsetof(struct jit_state, chain_site));
+    emit_jmp(jit, jit->exit_stub);
+}
+
+/* Function emit_dynamic_exit ends the block after R7 was computed at run time. */
+static void emit_dynamic_exit(struct jit *jit, int ninsns)
+{
+    EMIT(0x41, 0x81, 0x6d, 0x00);          /* sub dword [r13 + budget], ninsns */
+    emit32(jit, ninsns);
+    emit_jmp(jit, jit->exit_stub);
+}
+
+/* Function emit_count emits an increment of profile counter *counter. */
+static void emit_count(struct jit *jit, uint64_t *counter)
+{
+    EMIT(0x48, 0xb8);                      /* mov rax, counter */
+    emit64(jit, (uint64_t)(uintptr_t) counter);
+    EMIT(0x48, 0xff, 0x00);                /* inc qword [rax] */
+}
+
+/* Function emit_condition_test jumps over the following code if cond doesn't hold.
+ * Returns the displacement field to patch. */
+static unsigned char *emit_condition_test(struct jit *jit, int cond)
+{
+    /* al = Z | N, taken from the pending result if there is one */
+    EMIT(0x0f, 0xb6, 0x43, OFF_PSW,            /* movzx eax, byte [rbx + psw] */
+         0x80, 0x7b, OFF_FLAGS_ZN, 0x00,       /* cmp byte [rbx + flags.zn], 0 */
+         0x74, 0x10,                           /* je 1f */
+         0x66, 0x83, 0x7b, OFF_FLAGS_RES, 0x00, /* cmp word [rbx + flags.res], 0 */
+         0x0f, 0x94, 0xc0,                     /* sete al */
+         0x0f, 0x98, 0xc1,                     /* sets cl */
+         0xc0, 0xe1, 0x03,                     /* shl cl, 3 */
+         0x08, 0xc8);                          /* or al, cl */
+                                               /* 1: */
+    switch (cond)
+    {
+    case EQ:
+        EMIT(0xa8, PSW_FLAG_Z);                /* test al, Z */
+        return emit_jcc(jit, JCC_JE, NULL);
+    case NE:
+        EMIT(0xa8, PSW_FLAG_Z);
+        return emit_jcc(jit, JCC_JNE, NULL);
+    case GT:
+    default:
+        EMIT(0xa8, PSW_FLAG_Z | PSW_FLAG_N);   /* test al, Z | N */
+        return emit_jcc(jit, JCC_JNE, NULL);
+    }
+}
+
+static int writes_dst(int opcode)
+{
+    return opcode != CMP && opcode != TEST && opcode != PUSH && opcode != CALL && opcode != IRET;
+}
+
+/* Function static_branch checks if e writes R7 with a value known at translation time.
+ * If so, it emits the flag updates of the write and returns the value in target. */
+static int static_branch(struct jit *jit, const struct icache_entry *e, uint16_t next, uint16_t *target)
+{
+    if (e->kind[1] != OPND_IMMED || (e->opcode != ADD && e->opcode != MOV))
+        return 0;
+
+    if (e->opcode == ADD)
+    {
+        *target = (uint16_t)(next + e->ir1);
+        emit_store_imm16(jit, OFF_FLAGS_A, next);
+        emit_store_imm16(jit, OFF_FLAGS_B, (uint16_t) e->ir1);
+        emit_store_imm16(jit, OFF_FLAGS_RES, *target);
+        emit_store_imm16(jit, OFF_FLAGS_ZN, FLAGS_CO_ADD << 8 | 1);
+    }
+    else
+    {
+        *target = (uint16_t) e->ir1;
+        emit_store_imm16(jit, OFF_FLAGS_RES, *target);
+        EMIT(0xc6, 0x43, OFF_FLAGS_ZN, 1);     /* mov byte [rbx + flags.zn], 1 */
+    }
+
+    return 1;
+}
+
+/* Function translate_insn emits host code for e, the instruction at address pc.
+ * Returns nonzero if e ends the block. */
+static int translate_insn(struct jit *jit, const struct icache_entry *e, uint16_t pc, uint16_t next, int ninsns)
+{
+    struct profile *prof = jit->vm->profile;
+    int branch = !e->illegal && writes_dst(e->opcode) && e->kind[0] == OPND_REG && e->reg[0] == 7;
+    int psw_write = !e->illegal && writes_dst(e->opcode) && e->kind[0] == OPND_PSW;
+    int ends_block = e->illegal || branch || psw_write || e->opcode == CALL || e->opcode == IRET;
+
+    if (prof)
+        emit_count(jit, &prof->count[pc]);
+
+    unsigned char *skip = NULL;
+    if (e->cond != AL && !e->illegal)
+        skip = emit_condition_test(jit, e->cond);
+
+    uint16_t target;
+    if (branch && static_branch(jit, e, next, &target))
+    {
+        if (target <= pc && idle_loop(jit->vm, pc) == ninsns)
+            emit_idle(jit, pc, ninsns);
+        emit_static_exit(jit, target, ninsns);
+    }
+    else if (e->opcode == CALL && !e->illegal)
+    {
+        emit_step(jit, e, next, ninsns);
+        if (e->kind[0] == OPND_MEM && e->kind[1] != OPND_MEM && e->kind[1] != OPND_REGIND)
+            emit_static_exit(jit, (uint16_t) e->ir1, ninsns);
+        else if (e->kind[0] == OPND_REGIND && e->reg[0] == 7 && e->kind[1] != OPND_MEM && e->kind[1] != OPND_REGIND)
+            emit_static_exit(jit, (uint16_t)(next + e->ir1), ninsns);
+        else
+            emit_dynamic_exit(jit, ninsns);
+    }
+    else if (branch || (e->opcode == IRET && !e->illegal))
+    {
+        emit_step(jit, e, next, ninsns);
+        emit_dynamic_exit(jit, ninsns);
+    }
+    else if (ends_block)
+    {
+        emit_step(jit, e, next, ninsns);
+        emit_static_exit(jit, next, ninsns);
+    }
+    else if (can_inline(e, next))
+    {
+        emit_inline(jit, e, next);
+    }
+    else
+    {
+        emit_step(jit, e, next, ninsns);
+    }
+
+    if (skip)
+    {
+        /* with a profile, the path taken if the condition doesn't hold counts it */
+        unsigned char *over = NULL;
+        if (prof && !ends_block)
+            over = emit_jmp(jit, NULL);
+        patch_rel32(skip, jit->code_ptr);
+        if (prof)
+            emit_count(jit, &prof->not_taken[pc]);
+        if (ends_block)
+            emit_static_exit(jit, next, ninsns);
+        if (over)
+            patch_rel32(over, jit->code_ptr);
+    }
+
+    return ends_block;
+}
+
+static void flush(struct jit *jit)
+{
+    memset(jit->block_map, 0, sizeof(jit->block_map));
+    jit->code_ptr = jit->code_start;
+    jit->generation = jit->vm->icache_generation;
+}
+
+static unsigned char *translate(struct jit *jit, uint16_t pc)
+{
+    if (jit->code_buf + JIT_BUFFER_SIZE - jit->code_ptr < JIT_MAX_BLOCK_CODE)
+        flush(jit);
+
+    unsigned char *block = jit->code_ptr;
+    uint16_t start = pc;
+    int ninsns = 0;
+    for (;;)
+    {
+        struct icache_entry *e = icache_lookup(jit->vm, pc);
+        uint16_t next = (uint16_t)(pc + e->len);
+        ++ninsns;
+        if (translate_insn(jit, e, pc, next, ninsns))
+            break;
+        if (ninsns == JIT_MAX_BLOCK_INSNS)
+        {
+            emit_static_exit(jit, next, ninsns);
+            break;
+        }
+        pc = next;
+    }
+
+    jit->block_map[start] = block;
+    return block;
+}
+
+static int init_jit(struct vm *vm)
+{
+    struct jit *jit = calloc(1, sizeof(struct jit));
+    if (!jit)
+        return 0;
+    jit->vm = vm;
+    vm->jit = jit;
+
+    jit->code_buf = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code_buf == MAP_FAILED)
+    {
+        write_log(LOG_ERROR, "jit: failed to map %dB of executable memory", JIT_BUFFER_SIZE);
+        jit->code_buf = NULL;
+        close_jit(vm);
+        return 0;
+    }
+    jit->code_ptr = jit->code_buf;
+
+    /* enter(cpu, mem, state, code) */
+    *(void **) &jit->enter = jit->code_ptr;
+    EMIT(0x53,                             /* push rbx */
+         0x41, 0x54,                       /* push r12 */
+         0x41, 0x55,                       /* push r13 */
+         0x48, 0x89, 0xfb,                 /* mov rbx, rdi */
+         0x49, 0x89, 0xf4,                 /* mov r12, rsi */
+         0x49, 0x89, 0xd5,                 /* mov r13, rdx */
+         0xff, 0xe1);                      /* jmp rcx */
+
+    jit->exit_stub = jit->code_ptr;
+    EMIT(0x41, 0x5d,                       /* pop r13 */
+         0x41, 0x5c,                       /* pop r12 */
+         0x5b,                             /* pop rbx */
+         0xc3);                            /* ret */
+
+    jit->code_start = jit->code_ptr;
+    flush(jit);
+    return 1;
+}
+
+void close_jit(struct vm *vm)
+{
+    if (!vm->jit)
+        return;
+    if (vm->jit->code_buf)
+        munmap(vm->jit->code_buf, JIT_BUFFER_SIZE);
+    free(vm->jit);
+    vm->jit = NULL;
+}
+
+/* Function next_budget returns the number of instructions to execute before the next scheduled event. */
+static int32_t next_budget(struct vm *vm)
+{
+    uint64_t until = vm->sched_next > vm->retired ? vm->sched_next - vm->retired : 1;
+    return until < INT32_MAX ? (int32_t) until : INT32_MAX;
+}
+
+/* Function interpret_one executes the instruction at R7 the way the interpreter does,
+ * so an interrupt pending before it is accepted right after it rather than after a whole block. */
+static void interpret_one(struct vm *vm)
+{
+    struct profile *prof = vm->profile;
+    uint16_t pc = (uint16_t) vm->cpu_context.reg[7];
+
+    fetch(vm);
+    decode(vm);
+    if (!ILLEGAL_INSTRUCTION(vm))
+    {
+        if (prof && !test_condition(vm, (vm->ir0 >> 14) & 0x3))
+            ++prof->not_taken[pc];
+        execute(vm);
+    }
+    if (prof)
+        ++prof->count[pc];
+    ++vm->retired;
+    --vm->jit->state.budget;
+    interrupt(vm);
+}
+
+void run_jit(struct vm *vm)
+{
+    if (!vm->jit && !init_jit(vm))
+    {
+        run_threaded(vm);
+        return;
+    }
+
+    struct jit *jit = vm->jit;
+    jit->state.budget = next_budget(vm);
+
+    while (!PSW_TEST_FLAG(vm, PSW_FLAG_H))
+    {
+        if (vm->intr && !PSW_TEST_FLAG(vm, PSW_FLAG_I))
+        {
+            interpret_one(vm);
+            if (jit->state.budget <= 0)
+            {
+                sched_run(vm);
+                jit->state.budget = next_budget(vm);
+            }
+            continue;
+        }
+
+        if (jit->generation != vm->icache_generation)
+            flush(jit);
+
+        uint16_t pc = (uint16_t) vm->cpu_context.reg[7];
+        unsigned char *block = jit->block_map[pc] ? jit->block_map[pc] : translate(jit, pc);
+
+        int32_t budget = jit->entry_budget = jit->state.budget;
+        jit->state.chain_site = NULL;
+        jit->enter(&vm->cpu_context, vm->mem, &jit->state, block);
+        vm->retired += (uint64_t)(budget - jit->state.budget);
+
+        if (jit->state.chain_site && jit->generation == vm->icache_generation)
+        {
+            /* link the exit to the successor block unless translating it flushed the buffer */
+            unsigned char *site = jit->state.chain_site;
+            pc = (uint16_t) vm->cpu_context.reg[7];
+            if (!jit->block_map[pc])
+            {
+                unsigned char *before = jit->code_ptr;
+                translate(jit, pc);
+                if (jit->code_ptr < before)
+                    site = NULL;
+            }
+            if (site)
+                patch_rel32(site + 1, jit->block_map[pc]);
+        }
+
+        if (vm->intr)
+            interrupt(vm);
+        if (jit->state.budget <= 0)
+        {
+            sched_run(vm);
+            jit->state.budget = next_budget(vm);
+        }
+    }
+}
+
+#else /* !__x86_64__ */
+
+void run_jit(struct vm *vm)
+{
+    write_log(LOG_NORMAL, "jit: not supported on this host, using the threaded engine");
+    run_threaded(vm);
+}
+
+void close_jit(struct vm *vm)
+{
+    (void) vm;
+}
+
+#endif /* __x86_64__ */
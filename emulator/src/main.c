@@ -4,43 +4,148 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+/* Note: non-standard headers, available on POSIX systems */
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "log.h"
+#include "vm.h"
+#include "devices.h"
 #include "terminal.h"
+#include "cmdline.h"
 #include "control.h"
+#include "farm.h"
+#include "snapshot.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "sampler.h"
+
+char *exec_filename = NULL;
+
+int batch_mode = 0;
+char *input_filename = NULL;
+char *output_filename = NULL;
+int exit_register = 0;
+
+char *farm_filename = NULL;
+char *results_filename = NULL;
+int farm_workers = 0;
+
+char *save_snapshot_filename = NULL;
+char *restore_snapshot_filename = NULL;
+uint64_t snapshot_at = 0;
+
+char *profile_filename = NULL;
+char *callgraph_filename = NULL;
+char *folded_filename = NULL;
+char *sample_filename = NULL;
+
+struct vm_options options = {
+    .engine = ENGINE_INTERP,
+    .timer_mode = TIMER_VIRTUAL,
+    .input_fd = STDIN_FILENO,
+    .output_fd = STDOUT_FILENO,
+    .trace_pc_hi = 0xffff,
+};
 
 int main(int argc, char *argv[])
 {
-    if (argc == 1)
+    parse_cmdline(argc, argv);
+
+    if (farm_filename)
     {
-        printf("ETF - System software - Emulator v1.0\n"
-               "Usage:\n\t%s [exec_file]\n", argv[0]);
-        return EXIT_SUCCESS;
+        set_log_level(LOG_ERROR);
+        open_log("emu.log");
+        atexit(close_log);
+        int status = run_farm(farm_filename, results_filename, farm_workers, &options, exit_register);
+        return stop_signal_caught() ? 128 + stop_signal_caught() : status;
     }
-    if (argc > 2)
+
+    FILE *bin = NULL;
+    if (!restore_snapshot_filename)
     {
-        fprintf(stderr, "%s allows at most one input file\n", argv[0]);
-        return EXIT_FAILURE;
+        bin = fopen(exec_filename, "rb");
+        if (!bin)
+        {
+            fprintf(stderr, "error: failed to open file '%s'\n", exec_filename);
+            return EXIT_FAILURE;
+        }
     }
 
-    FILE *bin = fopen(argv[1], "rb");
-    if (!bin)
+    if (input_filename)
     {
-        fprintf(stderr, "error: failed to open file '%s'\n", argv[1]);
-        return EXIT_FAILURE;
+        options.input_fd = open(input_filename, O_RDONLY);
+        if (options.input_fd < 0)
+        {
+            fprintf(stderr, "error: failed to open file '%s'\n", input_filename);
+            return EXIT_FAILURE;
+        }
+    }
+    if (output_filename)
+    {
+        options.output_fd = open(output_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (options.output_fd < 0)
+        {
+            fprintf(stderr, "error: failed to open file '%s'\n", output_filename);
+            return EXIT_FAILURE;
+        }
     }
 
     /* set logging policy */
-    set_log_level(LOG_DEBUG);
+    set_log_level(batch_mode ? LOG_ERROR : LOG_DEBUG);
     open_log("emu.log");
     atexit(close_log);
-    write_log(LOG_NORMAL, "file: '%s'", argv[1]);
+    write_log(LOG_NORMAL, "file: '%s'", restore_snapshot_filename ? restore_snapshot_filename : exec_filename);
 
-    /* set terminal settings */
-    enable_raw_mode();
-    atexit(disable_raw_mode);
+    /* set terminal settings, unless input is replayed */
+    if (!batch_mode && !options.replay_filename)
+    {
+        enable_raw_mode();
+        atexit(disable_raw_mode);
+    }
 
-    run(bin);
+    /* a snapshot is saved once the CPU halts or stops after snapshot_at instructions */
+    if (save_snapshot_filename)
+        options.max_insns = snapshot_at;
 
-    return EXIT_SUCCESS;
-}
+    struct vm *vm = vm_create(&options);
+    if (!vm)
+        return EXIT_FAILURE;
+
+    int ok;
+    if (restore_snapshot_filename)
+    {
+        ok = restore_snapshot(vm, restore_snapshot_filename);
+        if (ok)
+            resume(vm);
+    }
+    else
+    {
+        ok = run(vm, bin);
+    }
+    if (ok && vm->failed)
+        ok = 0;
+    if (ok && save_snapshot_filename)
+        ok = save_snapshot(vm, save_snapshot_filename);
+    if (ok && profile_filename)
+        ok = write_profile(vm, bin, profile_filename);
+    if (ok && (callgraph_filename || folded_filename))
+        ok = write_callgraph(vm, bin, callgraph_filename, folded_filename);
+    if (ok && sample_filename)
+        ok = write_samples(vm, bin, sample_filename);
 
+    int status = EXIT_SUCCESS;
+    if (!ok)
+        status = EXIT_FAILURE;
+    else if (batch_mode)
+        /* the low 8 bits of the exit register become the exit status */
+        status = (uint16_t) vm->cpu_context.reg[exit_register] & 0xff;
+
+    if (stop_signal_caught())
+        status = 128 + stop_signal_caught();
+
+    if (bin)
+        fclose(bin);
+    vm_destroy(vm);
+    return status;
+}
@@ -1,34 +0,0 @@
-/* File: mem.c */
-/* Emulated memory. */
-
-#include <stdint.h>
-
-#define MEM_SIZE UINT16_MAX + 1 /* 2^16B */
-
-unsigned char mem[MEM_SIZE] = { 0 };
-
-#if 0
-unsigned char mem[MEM_SIZE] = {
-
-    /* Interrupt Vector Table [0x0000 - 0x000f] */
-    0x10, 0x00,
-    0x1a, 0x00,
-    0x00, 0x00,
-    0x00, 0x00,
-    0x00, 0x00,
-    0x00, 0x00,
-    0x00, 0x00,
-    0x00, 0x00,
-
-    /* Default interrupt routine 0 */
-    0xf5, 0x00, 0x30, 0x00, 0xf6, 0x08, 0xfe, 0xff, 0xf1, 0x08,
-
-    /* Default interrupt routine 1 */
-    0xf5, 0x10, 0xfc, 0xff, 0xf6, 0x08, 0xfe, 0xff, 0xf1, 0x08,
-
-    /* Default interrupt routine 2 */
-    0xf5, 0x10, 0xfc, 0xff, 0xf6, 0x08, 0xfe, 0xff, 0xf1, 0x08
-
-};
-#endif
-
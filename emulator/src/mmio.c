@@ -0,0 +1,96 @@
+/* File: mmio.c */
+/* Memory-mapped device registers. */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "vm.h"
+#include "icache.h"
+#include "mmio.h"
+
+/* Register a byte of the MMIO page belongs to. */
+struct mmio_entry {
+    int attached;
+    uint16_t reg;
+    mmio_callback read;
+    mmio_callback write;
+};
+
+/* Dispatch table, indexed by address - MMIO_BASE. */
+struct mmio {
+    struct mmio_entry map[MMIO_SIZE];
+};
+
+int init_mmio(struct vm *vm)
+{
+    vm->mmio = calloc(1, sizeof(struct mmio));
+    return vm->mmio != NULL;
+}
+
+void close_mmio(struct vm *vm)
+{
+    free(vm->mmio);
+    vm->mmio = NULL;
+}
+
+int mmio_attach(struct vm *vm, uint16_t reg, unsigned size, mmio_callback read, mmio_callback write)
+{
+    struct mmio *m = vm->mmio;
+    if (reg < MMIO_BASE || size == 0 || size > (unsigned)(MEM_SIZE - reg))
+        return 0;
+
+    unsigned i;
+    for (i = 0; i < size; ++i)
+        if (m->map[reg - MMIO_BASE + i].attached)
+            return 0;
+    for (i = 0; i < size; ++i)
+    {
+        struct mmio_entry *e = &m->map[reg - MMIO_BASE + i];
+        e->attached = 1;
+        e->reg = reg;
+        e->read = read;
+        e->write = write;
+    }
+    return 1;
+}
+
+void mmio_set(struct vm *vm, uint16_t addr, uint8_t value)
+{
+    vm->mem[addr] = value;
+    icache_write(vm, addr);
+}
+
+/* Function entry returns the table entry of byte addr, NULL if it isn't in the MMIO page. */
+static const struct mmio_entry *entry(struct vm *vm, uint16_t addr)
+{
+    return addr >= MMIO_BASE ? &vm->mmio->map[addr - MMIO_BASE] : NULL;
+}
+
+void mmio_dispatch_read(struct vm *vm, uint16_t addr)
+{
+    if (addr == UINT16_MAX)
+        vm->mem[MEM_SIZE] = vm->mem[0];
+
+    const struct mmio_entry *lo = entry(vm, addr);
+    const struct mmio_entry *hi = entry(vm, (uint16_t)(addr + 1));
+    if (lo && lo->read)
+        lo->read(vm, lo->reg);
+    if (hi && hi->read && !(lo && lo->attached && lo->reg == hi->reg))
+        hi->read(vm, hi->reg);
+}
+
+void mmio_dispatch_write(struct vm *vm, uint16_t addr)
+{
+    if (addr == UINT16_MAX)
+    {
+        vm->mem[0] = vm->mem[MEM_SIZE];
+        icache_write(vm, 0);
+    }
+
+    const struct mmio_entry *lo = entry(vm, addr);
+    const struct mmio_entry *hi = entry(vm, (uint16_t)(addr + 1));
+    if (lo && lo->write)
+        lo->write(vm, lo->reg);
+    if (hi && hi->write && !(lo && lo->attached && lo->reg == hi->reg))
+        hi->write(vm, hi->reg);
+}
@@ -0,0 +1,442 @@
+/* File: net.c */
+/* Packet device. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Note: non-standard headers, available on POSIX systems */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "log.h"
+#include "vm.h"
+#include "icache.h"
+#include "mmio.h"
+#include "sched.h"
+#include "net.h"
+
+/* pcap file and record headers. */
+struct pcap_header {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_record {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+/* Packet device state. */
+struct net {
+    /* Host backend: pcap files, or a datagram socket. */
+    FILE *in;
+    FILE *out;
+    int in_swapped;            /* the input file was written on a host of the other byte order */
+    int fd;
+    int bound;                 /* fd is bound at options.net_socket, which close_net_device removes */
+    struct sockaddr_un peer;   /* sender of the last packet received */
+    socklen_t peer_len;
+
+    /* Packet read from the backend that didn't fit in the receive ring yet. */
+    unsigned char packet[NET_MAX_PACKET];
+    size_t packet_len;
+    int packet_held;
+
+    /* Registers the guest can't write. */
+    uint16_t tx_head;
+    uint16_t rx_head;
+    uint16_t status;
+
+    /* Receive interrupt coalescing. */
+    unsigned unsignaled;       /* packets received since the last interrupt */
+    uint64_t first_at;         /* vm->retired when the first of them was received */
+    int irq;                   /* the interrupt is waiting for the CPU */
+
+    uint64_t received;
+    uint64_t sent;
+    uint64_t interrupts;
+    uint64_t start_retired;    /* vm->retired and CLOCK_MONOTONIC time when the device was created */
+    struct timespec start_time;
+};
+
+static uint16_t read_word(struct vm *vm, uint16_t addr)
+{
+    return (uint16_t)(vm->mem[addr] | vm->mem[(uint16_t)(addr + 1)] << 8);
+}
+
+static void write_word(struct vm *vm, uint16_t addr, uint16_t value)
+{
+    mmio_set(vm, addr, (uint8_t) value);
+    mmio_set(vm, (uint16_t)(addr + 1), (uint8_t)(value >> 8));
+}
+
+static uint32_t swap32(uint32_t v)
+{
+    return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+/* Function ring_size returns the number of descriptors of both rings, 0 if either doesn't
+ * fit below the MMIO page or holds less than two. */
+static unsigned ring_size(struct vm *vm)
+{
+    unsigned size = read_word(vm, NET_RING_SIZE_REGISTER);
+    unsigned bytes = size * NET_DESCRIPTOR_SIZE;
+    if (size < 2 || read_word(vm, NET_TX_RING_REGISTER) + bytes > MMIO_BASE
+        || read_word(vm, NET_RX_RING_REGISTER) + bytes > MMIO_BASE)
+        return 0;
+    return size;
+}
+
+/* Function buffer_len returns the length of the buffer of len bytes at addr, cut short at the MMIO page. */
+static size_t buffer_len(uint16_t addr, uint16_t len)
+{
+    return addr >= MMIO_BASE ? 0 : addr + (size_t) len > MMIO_BASE ? MMIO_BASE - addr : len;
+}
+
+/* Function next_packet reads the next packet from the backend into n->packet.
+ * Returns 0 if there is none yet. */
+static int next_packet(struct vm *vm)
+{
+    struct net *n = vm->net;
+    if (n->packet_held)
+        return 1;
+
+    if (n->fd >= 0)
+    {
+        struct sockaddr_un peer;
+        socklen_t peer_len = sizeof(peer);
+        ssize_t len = recvfrom(n->fd, n->packet, sizeof(n->packet), MSG_DONTWAIT,
+                               (struct sockaddr *) &peer, &peer_len);
+        if (len < 0)
+            return 0;
+        n->peer = peer;
+        n->peer_len = peer_len;
+        n->packet_len = (size_t) len;
+        return n->packet_held = 1;
+    }
+
+    struct pcap_record rec;
+    if (!n->in || (n->status & NET_RX_EOF))
+        return 0;
+    if (fread(&rec, sizeof(rec), 1, n->in) == 1)
+    {
+        uint32_t len = n->in_swapped ? swap32(rec.incl_len) : rec.incl_len;
+        if (len <= NET_MAX_PACKET && fread(n->packet, 1, len, n->in) == len)
+        {
+            n->packet_len = len;
+            return n->packet_held = 1;
+        }
+        write_log(LOG_ERROR, "net: truncated or oversized packet in '%s'", vm->options.net_in_filename);
+    }
+    n->status |= NET_RX_EOF;
+    write_word(vm, NET_STATUS_REGISTER, n->status);
+    n->irq = 1; /* the guest may be waiting for more */
+    return 0;
+}
+
+/* Function send_packet sends len bytes at guest address addr to the backend. */
+static void send_packet(struct vm *vm, uint16_t addr, size_t len)
+{
+    struct net *n = vm->net;
+    ++n->sent;
+
+    if (n->fd >= 0)
+    {
+        /* there is nobody to reply to before the first packet is received */
+        if (n->peer_len > sizeof(sa_family_t))
+            sendto(n->fd, vm->mem + addr, len, MSG_DONTWAIT, (struct sockaddr *) &n->peer, n->peer_len);
+        return;
+    }
+    if (!n->out)
+        return;
+
+    struct pcap_record rec = {
+        .ts_sec = (uint32_t)(vm->retired / 1000000),
+        .ts_usec = (uint32_t)(vm->retired % 1000000),
+        .incl_len = (uint32_t) len,
+        .orig_len = (uint32_t) len,
+    };
+    fwrite(&rec, sizeof(rec), 1, n->out);
+    fwrite(vm->mem + addr, 1, len, n->out);
+}
+
+/* Function transmit sends the packets of the transmit ring. */
+static void transmit(struct vm *vm)
+{
+    struct net *n = vm->net;
+    unsigned size = ring_size(vm);
+    if (size == 0)
+        return;
+
+    uint16_t ring = read_word(vm, NET_TX_RING_REGISTER);
+    unsigned tail = read_word(vm, NET_TX_TAIL_REGISTER) % size;
+    unsigned head = n->tx_head % size;
+    for (; head != tail; head = (head + 1) % size)
+    {
+        uint16_t desc = (uint16_t)(ring + head * NET_DESCRIPTOR_SIZE);
+        uint16_t addr = read_word(vm, desc);
+        send_packet(vm, addr, buffer_len(addr, read_word(vm, (uint16_t)(desc + 2))));
+    }
+    n->tx_head = (uint16_t) head;
+    write_word(vm, NET_TX_HEAD_REGISTER, n->tx_head);
+}
+
+/* Function receive fills the free descriptors of the receive ring with packets from the backend. */
+static void receive(struct vm *vm)
+{
+    struct net *n = vm->net;
+    unsigned size = ring_size(vm);
+    if (size == 0)
+        return;
+
+    uint16_t ring = read_word(vm, NET_RX_RING_REGISTER);
+    unsigned tail = read_word(vm, NET_RX_TAIL_REGISTER) % size;
+    unsigned head = n->rx_head % size;
+    for (; head != tail && next_packet(vm); head = (head + 1) % size)
+    {
+        uint16_t desc = (uint16_t)(ring + head * NET_DESCRIPTOR_SIZE);
+        uint16_t addr = read_word(vm, desc);
+        size_t len = buffer_len(addr, read_word(vm, (uint16_t)(desc + 2)));
+        if (len > n->packet_len)
+            len = n->packet_len;
+
+        memcpy(vm->mem + addr, n->packet, len);
+        size_t i;
+        for (i = 0; i < len; i += 2)
+            icache_write(vm, (uint16_t)(addr + i));
+        write_word(vm, (uint16_t)(desc + 2), (uint16_t) len);
+
+        n->packet_held = 0;
+        ++n->received;
+        if (n->unsignaled++ == 0)
+            n->first_at = vm->retired;
+    }
+    n->rx_head = (uint16_t) head;
+    write_word(vm, NET_RX_HEAD_REGISTER, n->rx_head);
+}
+
+/* Function net_event polls the receive side and raises the receive interrupt when it is due,
+ * without overwriting another one. */
+static void net_event(struct vm *vm)
+{
+    struct net *n = vm->net;
+    receive(vm);
+
+    unsigned packets = read_word(vm, NET_COALESCE_PACKETS_REGISTER);
+    unsigned delay = read_word(vm, NET_COALESCE_DELAY_REGISTER);
+    if (n->unsignaled > 0 && (n->unsignaled >= packets || (delay && vm->retired - n->first_at >= delay)))
+    {
+        n->unsignaled = 0;
+        n->irq = 1;
+    }
+    if (n->irq && !vm->intr && !PSW_TEST_FLAG(vm, PSW_FLAG_I))
+    {
+        n->irq = 0;
+        ++n->interrupts;
+        vm->intr = 1;
+        vm->ivtentry = NET_DEVICE_IVTENTRY;
+    }
+    sched_at(vm, vm->retired + NET_POLL_INTERVAL, net_event);
+}
+
+static void tx_tail_write(struct vm *vm, uint16_t reg)
+{
+    (void) reg;
+    transmit(vm);
+}
+
+/* Function read_only_write restores a register the guest wrote over. */
+static void read_only_write(struct vm *vm, uint16_t reg)
+{
+    struct net *n = vm->net;
+    write_word(vm, reg, reg == NET_TX_HEAD_REGISTER ? n->tx_head
+                        : reg == NET_RX_HEAD_REGISTER ? n->rx_head : n->status);
+}
+
+/* Function open_input opens the packet file to receive from. Returns 0 on failure. */
+static int open_input(struct vm *vm, const char *filename)
+{
+    struct net *n = vm->net;
+    struct pcap_header hdr;
+    n->in = fopen(filename, "rb");
+    if (!n->in)
+    {
+        write_log(LOG_ERROR, "net: failed to open file '%s'", filename);
+        return 0;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, n->in) != 1
+        || (hdr.magic != NET_PCAP_MAGIC && hdr.magic != swap32(NET_PCAP_MAGIC)))
+    {
+        write_log(LOG_ERROR, "net: '%s' is not a pcap file", filename);
+        return 0;
+    }
+    n->in_swapped = hdr.magic != NET_PCAP_MAGIC;
+    return 1;
+}
+
+/* Function open_output creates the packet file to send to. Returns 0 on failure. */
+static int open_output(struct vm *vm, const char *filename)
+{
+    struct net *n = vm->net;
+    struct pcap_header hdr = {
+        .magic = NET_PCAP_MAGIC,
+        .version_major = 2,
+        .version_minor = 4,
+        .snaplen = NET_MAX_PACKET,
+        .linktype = NET_PCAP_LINKTYPE,
+    };
+    n->out = fopen(filename, "wb");
+    if (!n->out)
+    {
+        write_log(LOG_ERROR, "net: failed to open file '%s'", filename);
+        return 0;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, n->out);
+    return 1;
+}
+
+/* Function open_socket binds the datagram socket at path. Returns 0 on failure. */
+static int open_socket(struct vm *vm, const char *path)
+{
+    struct net *n = vm->net;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        write_log(LOG_ERROR, "net: socket path '%s' is too long", path);
+        return 0;
+    }
+    strcpy(addr.sun_path, path);
+
+    /* replace the socket a previous run left behind, but nothing else */
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    n->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (n->fd < 0 || bind(n->fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        write_log(LOG_ERROR, "net: failed to bind socket '%s'", path);
+        if (n->fd >= 0)
+            close(n->fd);
+        n->fd = -1;
+        return 0;
+    }
+    n->bound = 1;
+    fcntl(n->fd, F_SETFD, FD_CLOEXEC);
+    return 1;
+}
+
+int init_net_device(struct vm *vm)
+{
+    const struct vm_options *o = &vm->options;
+    if (!o->net_in_filename && !o->net_out_filename && !o->net_socket)
+        return 1;
+
+    struct net *n = vm->net = calloc(1, sizeof(struct net));
+    if (!n)
+        return 0;
+    n->fd = -1;
+
+    if ((o->net_socket && !open_socket(vm, o->net_socket))
+        || (o->net_in_filename && !open_input(vm, o->net_in_filename))
+        || (o->net_out_filename && !open_output(vm, o->net_out_filename)))
+        return 0;
+    if (!o->net_socket && !o->net_in_filename)
+        n->status = NET_RX_EOF;
+
+    uint16_t reg;
+    for (reg = NET_TX_RING_REGISTER; reg <= NET_STATUS_REGISTER; reg += 2)
+    {
+        mmio_callback write = NULL;
+        if (reg == NET_TX_TAIL_REGISTER)
+            write = tx_tail_write;
+        else if (reg == NET_TX_HEAD_REGISTER || reg == NET_RX_HEAD_REGISTER || reg == NET_STATUS_REGISTER)
+            write = read_only_write;
+        if (!mmio_attach(vm, reg, 2, NULL, write))
+            return 0;
+    }
+    write_word(vm, NET_STATUS_REGISTER, n->status);
+
+    n->start_retired = vm->retired;
+    clock_gettime(CLOCK_MONOTONIC, &n->start_time);
+    sched_at(vm, vm->retired + NET_POLL_INTERVAL, net_event);
+    return 1;
+}
+
+void close_net_device(struct vm *vm)
+{
+    struct net *n = vm->net;
+    if (!n)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (double)(now.tv_sec - n->start_time.tv_sec) + (double)(now.tv_nsec - n->start_time.tv_nsec) / 1e9;
+    uint64_t packets = n->received > n->sent ? n->received : n->sent;
+    write_log(LOG_NORMAL, "net: %llu packets received, %llu sent, %llu receive interrupts",
+              (unsigned long long) n->received, (unsigned long long) n->sent,
+              (unsigned long long) n->interrupts);
+    if (packets > 0 && seconds > 0)
+        write_log(LOG_NORMAL, "net: %.1f instructions and %.3f us per packet, %.0f packets/s",
+                  (double)(vm->retired - n->start_retired) / (double) packets,
+                  seconds * 1e6 / (double) packets, (double) packets / seconds);
+    if (n->in)
+        fclose(n->in);
+    if (n->out && fclose(n->out) != 0)
+        write_log(LOG_ERROR, "net: failed to write file '%s'", vm->options.net_out_filename);
+    if (n->fd >= 0)
+        close(n->fd);
+    if (n->bound)
+        unlink(vm->options.net_socket);
+    free(n);
+    vm->net = NULL;
+}
+
+int net_pending(struct vm *vm)
+{
+    struct net *n = vm->net;
+    if (!n)
+        return 0;
+    if (n->irq || n->unsignaled > 0)
+        return 1;
+
+    /* the next poll fills a free descriptor from the file */
+    unsigned size = ring_size(vm);
+    return n->in && !(n->status & NET_RX_EOF) && size
+        && read_word(vm, NET_RX_TAIL_REGISTER) % size != n->rx_head % size;
+}
+
+int net_socket(struct vm *vm)
+{
+    return vm->net ? vm->net->fd : -1;
+}
+
+void restart_net_device(struct vm *vm)
+{
+    struct net *n = vm->net;
+    if (!n)
+        return;
+
+    n->tx_head = read_word(vm, NET_TX_HEAD_REGISTER);
+    n->rx_head = read_word(vm, NET_RX_HEAD_REGISTER);
+    write_word(vm, NET_STATUS_REGISTER, n->status);
+    n->unsignaled = 0;
+    n->irq = 0;
+    sched_at(vm, vm->retired + NET_POLL_INTERVAL, net_event);
+}
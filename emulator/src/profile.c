@@ -0,0 +1,190 @@
+/* File: profile.c */
+/* Execution profile: retired instructions per address. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "vm.h"
+#include "constants.h"
+#include "symbols.h"
+#include "profile.h"
+
+int init_profile(struct vm *vm)
+{
+    if (!vm->options.profile)
+        return 1;
+
+    vm->profile = calloc(1, sizeof(struct profile));
+    if (!vm->profile)
+    {
+        write_log(LOG_ERROR, "profile: failed to allocate %dB of counters", (int) sizeof(struct profile));
+        return 0;
+    }
+    return 1;
+}
+
+void close_profile(struct vm *vm)
+{
+    free(vm->profile);
+    vm->profile = NULL;
+}
+
+/* Report line: counters summed over an address or a symbol. */
+struct hot_spot {
+    uint64_t count;
+    uint64_t not_taken;
+    uint32_t key;       /* address, or index into the symbols */
+    int conditional;
+};
+
+static int compare_hot_spots(const void *a, const void *b)
+{
+    const struct hot_spot *x = a;
+    const struct hot_spot *y = b;
+    if (x->count != y->count)
+        return x->count > y->count ? -1 : 1;
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+/* Function is_conditional checks if the instruction at address pc, as it is in memory
+ * at the end of the run, executes only if a condition holds. */
+static int is_conditional(struct vm *vm, uint16_t pc)
+{
+    return ((vm->mem[pc] >> 6) & 0x3) != AL;
+}
+
+/* Function collect_hot_spots fills spots with the nonzero counters of count, sorted by count.
+ * Returns their number. */
+static uint32_t collect_hot_spots(struct vm *vm, const uint64_t *count, const uint64_t *not_taken,
+                                  struct hot_spot *spots, uint64_t *total)
+{
+    uint32_t pc, n = 0;
+    *total = 0;
+    for (pc = 0; pc < MEM_SIZE; ++pc)
+    {
+        if (!count[pc])
+            continue;
+        spots[n].count = count[pc];
+        spots[n].not_taken = not_taken ? not_taken[pc] : 0;
+        spots[n].key = pc;
+        spots[n].conditional = not_taken && (not_taken[pc] || is_conditional(vm, (uint16_t) pc));
+        *total += count[pc];
+        ++n;
+    }
+    qsort(spots, n, sizeof(struct hot_spot), compare_hot_spots);
+    return n;
+}
+
+void write_symbol_counts(FILE *fp, const char *title, const struct symbols *syms, const uint64_t *count)
+{
+    /* the last slot collects addresses that no symbol precedes */
+    uint32_t i, n = syms->count + 1;
+    struct hot_spot *spots = calloc(n, sizeof(struct hot_spot));
+    if (!spots)
+    {
+        write_log(LOG_ERROR, "profile: out of memory");
+        return;
+    }
+
+    uint64_t total = 0;
+    uint32_t pc;
+    for (i = 0; i < n; ++i)
+        spots[i].key = i;
+    for (pc = 0; pc < MEM_SIZE; ++pc)
+    {
+        if (!count[pc])
+            continue;
+        const struct symbol *sym = find_nearest_symbol(syms, (uint16_t) pc);
+        spots[sym ? (uint32_t)(sym - syms->sym) : syms->count].count += count[pc];
+        total += count[pc];
+    }
+    qsort(spots, n, sizeof(struct hot_spot), compare_hot_spots);
+
+    fprintf(fp, "# by %s\n"
+                "#%19s %8s  %s\n", title, "count", "%", "symbol");
+    for (i = 0; i < n && spots[i].count; ++i)
+        fprintf(fp, "%20llu %7.2f%%  %s\n", (unsigned long long) spots[i].count,
+                100.0 * spots[i].count / total,
+                spots[i].key < syms->count ? syms->sym[spots[i].key].name : "(no symbol)");
+
+    free(spots);
+}
+
+void write_address_counts(FILE *fp, struct vm *vm, const struct symbols *syms,
+                          const uint64_t *count, const uint64_t *not_taken)
+{
+    struct hot_spot *spots = malloc(MEM_SIZE * sizeof(struct hot_spot));
+    if (!spots)
+    {
+        write_log(LOG_ERROR, "profile: out of memory");
+        return;
+    }
+
+    uint64_t total;
+    uint32_t i, n = collect_hot_spots(vm, count, not_taken, spots, &total);
+
+    fprintf(fp, "# by address\n"
+                "#%19s %8s ", "count", "%");
+    if (not_taken)
+        fprintf(fp, "%20s %20s ", "taken", "not taken");
+    fprintf(fp, " %-8s %s\n", "address", "symbol");
+
+    char name[2 * SYMBOL_MAXLEN];
+    for (i = 0; i < n; ++i)
+    {
+        const struct hot_spot *spot = &spots[i];
+        format_address(syms, (uint16_t) spot->key, name, sizeof(name));
+        fprintf(fp, "%20llu %7.2f%% ", (unsigned long long) spot->count, 100.0 * spot->count / total);
+        if (spot->conditional)
+            fprintf(fp, "%20llu %20llu ", (unsigned long long)(spot->count - spot->not_taken),
+                    (unsigned long long) spot->not_taken);
+        else if (not_taken)
+            fprintf(fp, "%20s %20s ", "-", "-");
+        fprintf(fp, " %#06x   %s\n", spot->key, name);
+    }
+
+    free(spots);
+}
+
+int write_profile(struct vm *vm, FILE *bin, const char *filename)
+{
+    struct profile *prof = vm->profile;
+    if (!prof)
+        return 1;
+
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+    {
+        write_log(LOG_ERROR, "profile: failed to open file '%s'", filename);
+        return 0;
+    }
+
+    struct symbols syms;
+    load_symbols(&syms, bin);
+
+    uint32_t pc, npcs = 0;
+    uint64_t total = 0;
+    for (pc = 0; pc < MEM_SIZE; ++pc)
+    {
+        total += prof->count[pc];
+        npcs += prof->count[pc] != 0;
+    }
+
+    fprintf(fp, "# %llu instructions retired at %u addresses\n", (unsigned long long) total, npcs);
+    if (total)
+    {
+        write_symbol_counts(fp, "symbol", &syms, prof->count);
+        write_address_counts(fp, vm, &syms, prof->count, prof->not_taken);
+    }
+
+    free_symbols(&syms);
+    if (fclose(fp) != 0)
+    {
+        write_log(LOG_ERROR, "profile: failed to write file '%s'", filename);
+        return 0;
+    }
+    write_log(LOG_NORMAL, "profile: written to '%s'", filename);
+    return 1;
+}
@@ -0,0 +1,198 @@
+/* File: replay.c */
+/* Record and replay of device events. */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "vm.h"
+#include "cpu.h"
+#include "sched.h"
+#include "devices.h"
+#include "replay.h"
+
+static const char *const event_names[] = { "input", "timer", "stop" };
+
+/* Recorded event. */
+struct event_record {
+    uint64_t at;    /* vm->retired when it happened */
+    int kind;
+    int value;
+};
+
+struct replay {
+    FILE *fp;       /* log being recorded, NULL in replay mode */
+    const char *filename;
+
+    /* Events to replay, in the order they happened, and the next one. */
+    struct event_record *events;
+    size_t count;
+    size_t next;
+};
+
+/* Function parse_event parses line into event e. Returns 0 if it isn't an event. */
+static int parse_event(const char *line, struct event_record *e)
+{
+    unsigned long long at;
+    char name[16];
+    int value = 0, n = 0;
+    if (sscanf(line, "%llu %15s %n", &at, name, &n) != 2)
+        return 0;
+
+    for (e->kind = 0; e->kind < (int)(sizeof(event_names) / sizeof(event_names[0])); ++e->kind)
+        if (strcmp(name, event_names[e->kind]) == 0)
+            break;
+    if (e->kind == REPLAY_INPUT)
+    {
+        int m = 0;
+        if (sscanf(line + n, "%d %n", &value, &m) != 1 || line[n + m] != '\0' || value < 0 || value > 0xff)
+            return 0;
+    }
+    else if (e->kind > REPLAY_STOP || line[n] != '\0')
+    {
+        return 0;
+    }
+    e->at = at;
+    e->value = value;
+    return 1;
+}
+
+/* Function load_events reads the event log fp into r. Returns 0 on failure. */
+static int load_events(struct replay *r, FILE *fp)
+{
+    char line[128];
+    size_t capacity = 0, lineno = 0;
+    uint64_t last = 0;
+
+    if (!fgets(line, sizeof(line), fp) || strncmp(line, REPLAY_HEADER, strlen(REPLAY_HEADER)) != 0)
+    {
+        write_log(LOG_ERROR, "replay: '%s' is not an event log", r->filename);
+        return 0;
+    }
+    for (lineno = 2; fgets(line, sizeof(line), fp); ++lineno)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        struct event_record e;
+        if (!parse_event(line, &e) || e.at < last)
+        {
+            write_log(LOG_ERROR, "replay: '%s':%zu: invalid event '%s'", r->filename, lineno, line);
+            return 0;
+        }
+        last = e.at;
+
+        if (r->count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 256;
+            struct event_record *events = realloc(r->events, capacity * sizeof(struct event_record));
+            if (!events)
+            {
+                write_log(LOG_ERROR, "replay: out of memory");
+                return 0;
+            }
+            r->events = events;
+        }
+        r->events[r->count++] = e;
+    }
+    return 1;
+}
+
+/* Function replay_event raises the events due now and schedules the next one. */
+static void replay_event(struct vm *vm)
+{
+    struct replay *r = vm->replay;
+    for (; r->next < r->count && r->events[r->next].at <= vm->retired; ++r->next)
+    {
+        const struct event_record *e = &r->events[r->next];
+        if (e->kind == REPLAY_INPUT)
+        {
+            input_device(vm, (char) e->value);
+        }
+        else if (e->kind == REPLAY_TIMER)
+        {
+            vm->intr = 1;
+            vm->ivtentry = TIMER_TICK_IVTENTRY;
+        }
+        else
+        {
+            vm->out_of_budget = 1;
+            PSW_SET_FLAG(vm, PSW_FLAG_H);
+        }
+    }
+    if (r->next < r->count)
+        sched_at(vm, r->events[r->next].at, replay_event);
+}
+
+int init_replay(struct vm *vm)
+{
+    const char *record = vm->options.record_filename;
+    const char *replay = vm->options.replay_filename;
+    if (!record && !replay)
+        return 1;
+
+    struct replay *r = calloc(1, sizeof(struct replay));
+    if (!r)
+    {
+        write_log(LOG_ERROR, "replay: out of memory");
+        return 0;
+    }
+    vm->replay = r;
+    r->filename = record ? record : replay;
+
+    FILE *fp = fopen(r->filename, record ? "w" : "r");
+    if (!fp)
+    {
+        write_log(LOG_ERROR, "replay: failed to open file '%s'", r->filename);
+        return 0;
+    }
+    if (record)
+    {
+        r->fp = fp;
+        fprintf(fp, "%s\n", REPLAY_HEADER);
+        return 1;
+    }
+
+    int ok = load_events(r, fp);
+    fclose(fp);
+    if (!ok)
+        return 0;
+
+    if (r->next < r->count)
+        sched_at(vm, r->events[r->next].at, replay_event);
+    write_log(LOG_NORMAL, "replay: %zu events read from '%s'", r->count, r->filename);
+    return 1;
+}
+
+void close_replay(struct vm *vm)
+{
+    struct replay *r = vm->replay;
+    if (!r)
+        return;
+
+    if (r->fp)
+    {
+        record_event(vm, REPLAY_STOP, 0);
+        if (fclose(r->fp) != 0)
+            write_log(LOG_ERROR, "replay: failed to write file '%s'", r->filename);
+    }
+    free(r->events);
+    free(r);
+    vm->replay = NULL;
+}
+
+void record_event(struct vm *vm, int kind, int value)
+{
+    struct replay *r = vm->replay;
+    if (!r->fp)
+        return;
+
+    if (kind == REPLAY_INPUT)
+        fprintf(r->fp, "%" PRIu64 " %s %d\n", vm->retired, event_names[kind], value);
+    else
+        fprintf(r->fp, "%" PRIu64 " %s\n", vm->retired, event_names[kind]);
+}
@@ -0,0 +1,180 @@
+/* File: sampler.c */
+/* Statistical profile: guest PC sampled every so many instructions. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Note: non-standard header, available on POSIX systems */
+#include <pthread.h>
+
+#include "log.h"
+#include "vm.h"
+#include "sched.h"
+#include "symbols.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "sampler.h"
+
+/* A sample: the PC in the low half, the innermost routine in the high half. */
+typedef uint32_t sample_t;
+
+struct sampler {
+    /* Ring of samples, written by the CPU and read by the drain thread. */
+    sample_t ring[SAMPLER_RING_SIZE];
+    atomic_uint head;   /* next sample to be drained, written by the drain thread */
+    atomic_uint tail;   /* next free slot, written by the CPU */
+
+    uint64_t dropped;   /* samples that found the ring full, written by the CPU */
+
+    /* Samples per PC and per innermost routine, written by the drain thread. */
+    uint64_t pc_samples[MEM_SIZE];
+    uint64_t routine_samples[MEM_SIZE];
+
+    pthread_t drain;
+    int drain_running;
+    atomic_int drain_stop;
+};
+
+static void drain_ring(struct sampler *s)
+{
+    unsigned head = atomic_load_explicit(&s->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&s->tail, memory_order_acquire);
+    for (; head != tail; ++head)
+    {
+        sample_t sample = s->ring[head & (SAMPLER_RING_SIZE - 1)];
+        ++s->pc_samples[sample & 0xffff];
+        ++s->routine_samples[sample >> 16];
+    }
+    atomic_store_explicit(&s->head, head, memory_order_release);
+}
+
+static void *drainer(void *arg)
+{
+    struct sampler *s = arg;
+    struct timespec delay = { .tv_sec = 0, .tv_nsec = SAMPLER_DRAIN_INTERVAL * 1000000L };
+    while (!atomic_load_explicit(&s->drain_stop, memory_order_relaxed))
+    {
+        drain_ring(s);
+        nanosleep(&delay, NULL);
+    }
+    return NULL;
+}
+
+/* Function sample_event puts the current PC into the ring and schedules the next sample. */
+static void sample_event(struct vm *vm)
+{
+    struct sampler *s = vm->sampler;
+    sample_t sample = (uint16_t) vm->cpu_context.reg[7];
+    if (vm->callgraph)
+        sample |= (sample_t) callgraph_top(vm) << 16;
+
+    unsigned tail = atomic_load_explicit(&s->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&s->head, memory_order_acquire);
+    if (tail - head == SAMPLER_RING_SIZE)
+    {
+        ++s->dropped;
+    }
+    else
+    {
+        s->ring[tail & (SAMPLER_RING_SIZE - 1)] = sample;
+        atomic_store_explicit(&s->tail, tail + 1, memory_order_release);
+    }
+
+    sched_at(vm, vm->retired + vm->options.sample_period, sample_event);
+}
+
+int init_sampler(struct vm *vm)
+{
+    if (!vm->options.sample_period)
+        return 1;
+
+    struct sampler *s = calloc(1, sizeof(struct sampler));
+    if (!s)
+    {
+        write_log(LOG_ERROR, "sampler: failed to allocate the sample ring");
+        return 0;
+    }
+    vm->sampler = s;
+
+    if (pthread_create(&s->drain, NULL, drainer, s) != 0)
+    {
+        write_log(LOG_ERROR, "sampler: failed to start the drain thread");
+        return 0;
+    }
+    s->drain_running = 1;
+    return 1;
+}
+
+/* Function stop_drain stops the drain thread and drains what it left in the ring. */
+static void stop_drain(struct sampler *s)
+{
+    if (s->drain_running)
+    {
+        atomic_store_explicit(&s->drain_stop, 1, memory_order_relaxed);
+        pthread_join(s->drain, NULL);
+        s->drain_running = 0;
+    }
+    drain_ring(s);
+}
+
+void close_sampler(struct vm *vm)
+{
+    if (!vm->sampler)
+        return;
+    stop_drain(vm->sampler);
+    free(vm->sampler);
+    vm->sampler = NULL;
+}
+
+void sampler_start(struct vm *vm)
+{
+    sched_at(vm, vm->retired + vm->options.sample_period, sample_event);
+}
+
+int write_samples(struct vm *vm, FILE *bin, const char *filename)
+{
+    struct sampler *s = vm->sampler;
+    if (!s)
+        return 1;
+    stop_drain(s);
+
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+    {
+        write_log(LOG_ERROR, "sampler: failed to open file '%s'", filename);
+        return 0;
+    }
+
+    struct symbols syms;
+    load_symbols(&syms, bin);
+
+    uint64_t total = 0;
+    uint32_t pc;
+    for (pc = 0; pc < MEM_SIZE; ++pc)
+        total += s->pc_samples[pc];
+
+    fprintf(fp, "# %llu samples, one every %llu instructions, %llu dropped\n",
+            (unsigned long long) total, (unsigned long long) vm->options.sample_period,
+            (unsigned long long) s->dropped);
+    if (total)
+    {
+        write_symbol_counts(fp, "symbol", &syms, s->pc_samples);
+        if (vm->callgraph)
+            write_symbol_counts(fp, "innermost routine of the call stack", &syms, s->routine_samples);
+        write_address_counts(fp, vm, &syms, s->pc_samples, NULL);
+    }
+
+    free_symbols(&syms);
+    if (fclose(fp) != 0)
+    {
+        write_log(LOG_ERROR, "sampler: failed to write file '%s'", filename);
+        return 0;
+    }
+    write_log(LOG_NORMAL, "sampler: %llu samples written to '%s'", (unsigned long long) total, filename);
+    return 1;
+}
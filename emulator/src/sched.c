@@ -0,0 +1,117 @@
+/* File: sched.c */
+/* Device event scheduler. */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "vm.h"
+#include "sched.h"
+
+/* Scheduled event. Events due at the same time run in the order they were scheduled. */
+struct event {
+    uint64_t deadline;
+    uint64_t seq;
+    void (*callback)(struct vm *);
+};
+
+/* Binary min-heap of events ordered by (deadline, seq). */
+struct sched {
+    struct event heap[SCHED_MAX_EVENTS];
+    int count;
+    uint64_t seq;
+};
+
+int init_sched(struct vm *vm)
+{
+    vm->sched = calloc(1, sizeof(struct sched));
+    vm->sched_next = UINT64_MAX;
+    return vm->sched != NULL;
+}
+
+void close_sched(struct vm *vm)
+{
+    free(vm->sched);
+    vm->sched = NULL;
+}
+
+static int before(const struct event *a, const struct event *b)
+{
+    return a->deadline < b->deadline || (a->deadline == b->deadline && a->seq < b->seq);
+}
+
+static void swap(struct event *heap, int i, int j)
+{
+    struct event tmp = heap[i];
+    heap[i] = heap[j];
+    heap[j] = tmp;
+}
+
+int sched_at(struct vm *vm, uint64_t deadline, void (*callback)(struct vm *))
+{
+    struct sched *s = vm->sched;
+    if (s->count == SCHED_MAX_EVENTS)
+    {
+        write_log(LOG_ERROR, "sched: more than %d events scheduled, machine stopped", SCHED_MAX_EVENTS);
+        vm->failed = 1;
+        PSW_SET_FLAG(vm, PSW_FLAG_H);
+        vm->sched_next = vm->retired; /* engines check the flag after running events */
+        return 0;
+    }
+
+    int i = s->count++;
+    s->heap[i].deadline = deadline;
+    s->heap[i].seq = s->seq++;
+    s->heap[i].callback = callback;
+
+    /* sift up */
+    while (i > 0 && before(&s->heap[i], &s->heap[(i - 1) / 2]))
+    {
+        swap(s->heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+
+    vm->sched_next = s->heap[0].deadline;
+    return 1;
+}
+
+void sched_clear(struct vm *vm)
+{
+    vm->sched->count = 0;
+    vm->sched_next = UINT64_MAX;
+}
+
+static void pop(struct sched *s)
+{
+    s->heap[0] = s->heap[--s->count];
+
+    /* sift down */
+    int i = 0;
+    for (;;)
+    {
+        int min = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < s->count && before(&s->heap[left], &s->heap[min]))
+            min = left;
+        if (right < s->count && before(&s->heap[right], &s->heap[min]))
+            min = right;
+        if (min == i)
+            break;
+        swap(s->heap, i, min);
+        i = min;
+    }
+}
+
+void sched_run(struct vm *vm)
+{
+    struct sched *s = vm->sched;
+    while (s->count > 0 && s->heap[0].deadline <= vm->retired)
+    {
+        void (*callback)(struct vm *) = s->heap[0].callback;
+        pop(s);
+        callback(vm);
+    }
+
+    vm->sched_next = s->count > 0 ? s->heap[0].deadline : UINT64_MAX;
+}
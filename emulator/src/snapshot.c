@@ -0,0 +1,157 @@
+/* File: snapshot.c */
+/* Machine snapshots. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Note: non-standard headers, available on POSIX systems */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "vm.h"
+#include "alu.h"
+#include "icache.h"
+#include "devices.h"
+#include "block.h"
+#include "net.h"
+#include "snapshot.h"
+
+/* Snapshot file header, in host byte order. */
+struct snapshot_header {
+    char magic[8];            /* SNAPSHOT_MAGIC */
+    uint32_t version;         /* SNAPSHOT_VERSION */
+    uint32_t mem_offset;      /* SNAPSHOT_MEM_OFFSET */
+    uint32_t mem_size;        /* MEM_SIZE */
+    uint8_t timer_mode;
+    uint8_t unused[3];
+    int16_t reg[8];
+    int16_t psw;
+    int16_t ivtp;
+    int16_t ivtentry;
+    int16_t intr;
+    uint64_t retired;
+    uint64_t timer_period;
+    uint64_t timer_remaining; /* until the next tick, in units of timer_mode */
+};
+
+int save_snapshot(struct vm *vm, const char *filename)
+{
+    /* pending flag updates are applied, so the PSW alone describes them */
+    psw_sync(vm);
+    flush_output(vm);
+
+    struct snapshot_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.mem_offset = SNAPSHOT_MEM_OFFSET;
+    hdr.mem_size = MEM_SIZE;
+    hdr.timer_mode = (uint8_t) vm->options.timer_mode;
+    memcpy(hdr.reg, vm->cpu_context.reg, sizeof(hdr.reg));
+    hdr.psw = vm->cpu_context.psw;
+    hdr.ivtp = vm->ivtp;
+    hdr.ivtentry = vm->ivtentry;
+    hdr.intr = (int16_t) vm->intr;
+    hdr.retired = vm->retired;
+    hdr.timer_period = vm->options.timer_period;
+    hdr.timer_remaining = timer_remaining(vm);
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+    {
+        write_log(LOG_ERROR, "snapshot: failed to open file '%s'", filename);
+        return 0;
+    }
+
+    static const unsigned char padding[SNAPSHOT_MEM_OFFSET];
+    int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1
+        && fwrite(padding, SNAPSHOT_MEM_OFFSET - sizeof(hdr), 1, fp) == 1
+        && fwrite(vm->mem, MEM_SIZE, 1, fp) == 1;
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok)
+    {
+        write_log(LOG_ERROR, "snapshot: failed to write file '%s'", filename);
+        return 0;
+    }
+    write_log(LOG_NORMAL, "snapshot: saved '%s' after %llu instructions",
+              filename, (unsigned long long) vm->retired);
+    return 1;
+}
+
+static int valid_header(const struct snapshot_header *hdr)
+{
+    return memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0
+        && hdr->version == SNAPSHOT_VERSION
+        && hdr->mem_offset == SNAPSHOT_MEM_OFFSET
+        && hdr->mem_size == MEM_SIZE
+        && (hdr->timer_mode == TIMER_VIRTUAL || hdr->timer_mode == TIMER_WALL_CLOCK)
+        && hdr->timer_period > 0;
+}
+
+int restore_snapshot(struct vm *vm, const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        write_log(LOG_ERROR, "snapshot: failed to open file '%s'", filename);
+        return 0;
+    }
+
+    struct snapshot_header hdr;
+    struct stat st;
+    if (read(fd, &hdr, sizeof(hdr)) != (ssize_t) sizeof(hdr) || !valid_header(&hdr)
+        || fstat(fd, &st) != 0 || st.st_size < SNAPSHOT_MEM_OFFSET + MEM_SIZE)
+    {
+        write_log(LOG_ERROR, "snapshot: '%s' is not a version %d snapshot", filename, SNAPSHOT_VERSION);
+        close(fd);
+        return 0;
+    }
+
+    void *mem = mmap(vm->mem, MEM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                     fd, SNAPSHOT_MEM_OFFSET);
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        write_log(LOG_ERROR, "snapshot: failed to map file '%s'", filename);
+        return 0;
+    }
+
+    memcpy(vm->cpu_context.reg, hdr.reg, sizeof(hdr.reg));
+    vm->cpu_context.psw = hdr.psw;
+    memset(&vm->cpu_context.flags, 0, sizeof(vm->cpu_context.flags));
+    vm->ivtp = hdr.ivtp;
+    vm->ivtentry = hdr.ivtentry;
+    vm->intr = hdr.intr;
+    vm->retired = hdr.retired;
+
+    vm->options.timer_mode = hdr.timer_mode;
+    vm->options.timer_period = hdr.timer_period;
+
+    icache_flush(vm);
+    restart_devices(vm, hdr.timer_remaining);
+    restart_block_device(vm);
+    restart_net_device(vm);
+
+    write_log(LOG_NORMAL, "snapshot: restored '%s' after %llu instructions",
+              filename, (unsigned long long) vm->retired);
+    return 1;
+}
+
+int is_snapshot(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return 0;
+
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    int match = fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+    fclose(fp);
+    return match;
+}
@@ -0,0 +1,124 @@
+/* File: symbols.c */
+/* Symbols of a loaded executable, for reports. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "obj_format.h"
+#include "symbols.h"
+
+static int compare_symbols(const void *a, const void *b)
+{
+    const struct symbol *x = a;
+    const struct symbol *y = b;
+    if (x->value != y->value)
+        return x->value < y->value ? -1 : 1;
+    /* segment symbols first, so other symbols at the same address are found */
+    if (x->section != y->section)
+        return x->section ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+static void add_symbol(struct symbols *syms, uint16_t value, int section, const char *name)
+{
+    struct symbol *sym = &syms->sym[syms->count++];
+    sym->value = value;
+    sym->section = (uint8_t) section;
+    strncpy(sym->name, name, SYMBOL_MAXLEN);
+    sym->name[SYMBOL_MAXLEN] = '\0';
+}
+
+/* Function load_flat_symbols reads the symbol section of a flat executable, if it has one. */
+static void load_flat_symbols(struct symbols *syms, FILE *bin, const FlatHeader *hdr)
+{
+    if (!hdr->symtab_offset || !hdr->sym_cnt || fseek(bin, hdr->symtab_offset, SEEK_SET) != 0)
+        return;
+
+    syms->sym = malloc(hdr->sym_cnt * sizeof(struct symbol));
+    if (!syms->sym)
+        return;
+
+    uint32_t i;
+    FlatSymbol entry;
+    for (i = 0; i < hdr->sym_cnt && fread(&entry, sizeof(FlatSymbol), 1, bin) == 1; ++i)
+        add_symbol(syms, entry.sym_val, 0, entry.sym_name);
+}
+
+/* Function load_image_symbols reads the symbol table at the start of an executable image. */
+static void load_image_symbols(struct symbols *syms, FILE *bin)
+{
+    SymbolTable symtab;
+    if (fseek(bin, 0, SEEK_SET) != 0 || read_symtab(&symtab, bin) != 0)
+        return;
+
+    syms->sym = malloc((symtab.sym_cnt ? symtab.sym_cnt : 1) * sizeof(struct symbol));
+    if (syms->sym)
+    {
+        SymbolTableNode *node;
+        for (node = symtab.first; node; node = node->next)
+            if (node->entry.sym_type == TYPE_SYMBOL || node->entry.sym_type == TYPE_SECTION)
+                add_symbol(syms, node->entry.sym_val, node->entry.sym_type == TYPE_SECTION,
+                           node->entry.sym_name);
+    }
+    free_symtab(&symtab);
+}
+
+void load_symbols(struct symbols *syms, FILE *bin)
+{
+    syms->sym = NULL;
+    syms->count = 0;
+    if (!bin)
+        return;
+
+    FlatHeader hdr;
+    if (fseek(bin, 0, SEEK_SET) == 0 && fread(&hdr, sizeof(FlatHeader), 1, bin) == 1
+        && memcmp(hdr.magic, FLAT_MAGIC, sizeof(hdr.magic)) == 0)
+        load_flat_symbols(syms, bin, &hdr);
+    else
+        load_image_symbols(syms, bin);
+
+    if (syms->count)
+        qsort(syms->sym, syms->count, sizeof(struct symbol), compare_symbols);
+    else
+        write_log(LOG_NORMAL, "symbols: none found, addresses are reported as they are");
+}
+
+void free_symbols(struct symbols *syms)
+{
+    free(syms->sym);
+    syms->sym = NULL;
+    syms->count = 0;
+}
+
+const struct symbol *find_nearest_symbol(const struct symbols *syms, uint16_t addr)
+{
+    /* binary search for the last symbol not above addr */
+    uint32_t lo = 0, hi = syms->count;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (syms->sym[mid].value <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+
+    /* the sort puts segment symbols before the others at the same address */
+    return &syms->sym[lo - 1];
+}
+
+void format_address(const struct symbols *syms, uint16_t addr, char *buf, size_t size)
+{
+    const struct symbol *sym = find_nearest_symbol(syms, addr);
+    if (!sym)
+        snprintf(buf, size, "%#06x", addr);
+    else if (sym->value == addr)
+        snprintf(buf, size, "%s", sym->name);
+    else
+        snprintf(buf, size, "%s+%#x", sym->name, addr - sym->value);
+}
@@ -0,0 +1,300 @@
+/* File: threaded.c */
+/* Threaded-code execution engine. */
+
+/* Note: labels as values are a GNU C extension */
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+#include <stdint.h>
+
+#include "vm.h"
+#include "constants.h"
+#include "icache.h"
+#include "alu.h"
+#include "mmio.h"
+#include "intr.h"
+#include "devices.h"
+#include "sched.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "idle.h"
+#include "threaded.h"
+
+/* Function source_operand resolves the source operand of a predecoded instruction.
+ * Memory operands also update the memory address register a, as in decode. */
+static inline int16_t *source_operand(struct vm *vm, const struct icache_entry *e, int16_t *imm, uint16_t *a)
+{
+    switch (e->kind[1])
+    {
+    case OPND_IMMED:
+        return imm;
+    case OPND_PSW:
+        psw_sync(vm);
+        return &vm->cpu_context.psw;
+    case OPND_REG:
+        return &vm->cpu_context.reg[e->reg[1]];
+    case OPND_MEM:
+        *a = (uint16_t) e->ir1;
+        mmio_read(vm, *a);
+        return (int16_t *)(vm->mem + *a);
+    case OPND_REGIND:
+    default:
+        *a = (uint16_t)(vm->cpu_context.reg[e->reg[1]] + e->ir1);
+        mmio_read(vm, *a);
+        return (int16_t *)(vm->mem + *a);
+    }
+}
+
+/* Destination operand resolution, one per operand kind. */
+#define DST_IMMED   dst = &imm;
+#define DST_PSW     psw_sync(vm); \
+                    dst = &vm->cpu_context.psw;
+#define DST_REG     dst = &vm->cpu_context.reg[e->reg[0]];
+#define DST_MEM     dst_addr = a = (uint16_t) e->ir1; \
+                    dst = (int16_t *)(vm->mem + a);
+#define DST_REGIND  dst_addr = a = (uint16_t)(vm->cpu_context.reg[e->reg[0]] + e->ir1); \
+                    dst = (int16_t *)(vm->mem + a);
+
+/* Device register reads of a destination operand the operation reads (R) or not (N). */
+#define READ_DST_IMMED(rd)
+#define READ_DST_PSW(rd)
+#define READ_DST_REG(rd)
+#define READ_DST_MEM(rd)    READ_DST_##rd
+#define READ_DST_REGIND(rd) READ_DST_##rd
+#define READ_DST_R          mmio_read(vm, dst_addr);
+#define READ_DST_N
+
+/* Side effects of writing the destination operand (W) or not writing it (N). */
+#define AFTER_IMMED_W
+#define AFTER_IMMED_N
+#define AFTER_PSW_W     if (PSW_TEST_FLAG(vm, PSW_FLAG_H)) goto halt;
+#define AFTER_PSW_N
+#define AFTER_REG_W
+#define AFTER_REG_N
+#define AFTER_MEM_W     icache_write(vm, dst_addr); \
+                        mmio_write(vm, dst_addr);
+#define AFTER_MEM_N
+#define AFTER_REGIND_W  AFTER_MEM_W
+#define AFTER_REGIND_N
+
+/* Operation bodies. */
+#define BODY_ADD    alu_add(vm, dst, src)
+#define BODY_SUB    alu_sub(vm, dst, src)
+#define BODY_MUL    alu_mul(vm, dst, src)
+#define BODY_DIV    alu_div(vm, dst, src)
+#define BODY_CMP    alu_cmp(vm, *dst, *src)
+#define BODY_AND    alu_and(vm, dst, src)
+#define BODY_OR     alu_or(vm, dst, src)
+#define BODY_NOT    alu_not(vm, dst)
+#define BODY_TEST   alu_test(vm, *dst, *src)
+#define BODY_PUSH   push(vm, *dst)
+#define BODY_POP    pop(vm, dst); \
+                    if (vm->callgraph && dst == &vm->cpu_context.reg[7]) callgraph_return(vm)
+#define BODY_CALL   call(vm, a); \
+                    if (vm->callgraph) callgraph_call(vm)
+#define BODY_IRET   iret(vm); \
+                    if (vm->callgraph) callgraph_iret(vm); \
+                    if (PSW_TEST_FLAG(vm, PSW_FLAG_H)) goto halt
+#define BODY_MOV    alu_mov(vm, dst, src)
+#define BODY_SHL    alu_shl(vm, dst, (uint16_t *) src)
+#define BODY_SHR    alu_shr(vm, dst, (uint16_t *) src)
+
+#define HANDLER(op, kind, rd, wb)                                       \
+    op##_##kind:                                                    \
+        if (e->cond != AL && !test_condition(vm, e->cond))          \
+        {                                                           \
+            if (prof)                                               \
+                ++prof->not_taken[e - vm->icache];                  \
+            goto next;                                              \
+        }                                                           \
+        imm = e->ir1;                                               \
+        a = (uint16_t) 0xffff;                                      \
+        DST_##kind                                                  \
+        READ_DST_##kind(rd)                                         \
+        src = source_operand(vm, e, &imm, &a);                      \
+        BODY_##op;                                                  \
+        AFTER_##kind##_##wb                                         \
+        goto next;
+
+#define HANDLERS(op, rd, wb)                                            \
+    HANDLER(op, IMMED, rd, wb)                                          \
+    HANDLER(op, PSW, rd, wb)                                            \
+    HANDLER(op, REG, rd, wb)                                            \
+    HANDLER(op, MEM, rd, wb)                                            \
+    HANDLER(op, REGIND, rd, wb)
+
+/* Fused handlers, see icache.h. Entry f starts the sequence and e is the
+ * instruction being executed. FUSED_NEXT retires e and moves on to the
+ * next instruction, unless an interrupt or event is due or e wrote over the
+ * sequence, in which case the next instruction is dispatched as usual. */
+#define FUSED_NEXT                                                  \
+        ++vm->retired;                                              \
+        if (vm->intr || vm->retired >= vm->sched_next || !f->valid) \
+            goto events;                                            \
+        e = &vm->icache[(uint16_t) vm->cpu_context.reg[7]];         \
+        vm->cpu_context.reg[7] += e->len;                           \
+        if (prof)                                                   \
+            ++prof->count[e - vm->icache];
+
+/* Instructions of fused sequences, destination register other than R7 unless noted. */
+#define FUSED_MOV                                                   \
+        imm = e->ir1;                                               \
+        src = source_operand(vm, e, &imm, &a);                      \
+        alu_mov(vm, &vm->cpu_context.reg[e->reg[0]], src);
+#define FUSED_CMP                                                   \
+        imm = e->ir1;                                               \
+        src = source_operand(vm, e, &imm, &a);                      \
+        alu_cmp(vm, vm->cpu_context.reg[e->reg[0]], *src);
+#define FUSED_PUSH                                                  \
+        push(vm, vm->cpu_context.reg[e->reg[0]]);
+#define FUSED_POP                                                   \
+        pop(vm, &vm->cpu_context.reg[e->reg[0]]);
+#define FUSED_RET                                                   \
+        pop(vm, &vm->cpu_context.reg[7]);                           \
+        if (vm->callgraph) callgraph_return(vm);
+#define FUSED_OUT                                                   \
+        alu_mov(vm, (int16_t *)(vm->mem + OUTPUT_DEVICE_ADDRESS),   \
+                &vm->cpu_context.reg[e->reg[1]]);                   \
+        icache_write(vm, OUTPUT_DEVICE_ADDRESS);                    \
+        mmio_write(vm, OUTPUT_DEVICE_ADDRESS);
+#define FUSED_JCC                                                   \
+        if (e->cond != AL && !test_condition(vm, e->cond))          \
+        {                                                           \
+            if (prof)                                               \
+                ++prof->not_taken[e - vm->icache];                  \
+            goto next;                                              \
+        }                                                           \
+        imm = e->ir1;                                               \
+        if (e->opcode == MOV)                                       \
+            alu_mov(vm, &vm->cpu_context.reg[7], &imm);             \
+        else                                                        \
+            alu_add(vm, &vm->cpu_context.reg[7], &imm);             \
+        if ((uint16_t) vm->cpu_context.reg[7] <= (uint16_t)(e - vm->icache)) \
+            idle_branch(vm, (uint16_t)(e - vm->icache));
+
+/* Handler addresses in ICACHE_HANDLER order. */
+#define TARGETS(op) &&op##_IMMED, &&op##_PSW, &&op##_REG, &&op##_MEM, &&op##_REGIND
+
+void run_threaded(struct vm *vm)
+{
+    static void *const handlers[] = {
+        TARGETS(ADD), TARGETS(SUB), TARGETS(MUL), TARGETS(DIV),
+        TARGETS(CMP), TARGETS(AND), TARGETS(OR), TARGETS(NOT),
+        TARGETS(TEST), TARGETS(PUSH), TARGETS(POP), TARGETS(CALL),
+        TARGETS(IRET), TARGETS(MOV), TARGETS(SHL), TARGETS(SHR),
+        &&ILLEGAL,
+        &&FUSED_MOV_CMP_JCC, &&FUSED_CMP_JCC, &&FUSED_PUSH_PUSH, &&FUSED_POP_POP,
+        &&FUSED_POP_RET, &&FUSED_MOV_OUT, &&FUSED_MOV_MOV, &&JCC,
+    };
+
+    struct profile *const prof = vm->profile;
+    struct icache_entry *e, *f;
+    int16_t *dst, *src;
+    int16_t imm;
+    uint16_t a, dst_addr;
+
+    (void) dst_addr;
+
+    vm->icache_fusion = 1;
+    goto dispatch;
+
+next:
+    ++vm->retired;
+events:
+    if (vm->intr)
+        interrupt(vm);
+    if (vm->retired >= vm->sched_next)
+    {
+        sched_run(vm);
+        if (PSW_TEST_FLAG(vm, PSW_FLAG_H))
+            return; /* stopped by an event */
+    }
+
+dispatch:
+    e = icache_lookup(vm, (uint16_t) vm->cpu_context.reg[7]);
+    vm->cpu_context.reg[7] += e->len;
+    if (prof)
+        ++prof->count[e - vm->icache];
+    goto *handlers[e->handler];
+
+    HANDLERS(ADD, R, W)
+    HANDLERS(SUB, R, W)
+    HANDLERS(MUL, R, W)
+    HANDLERS(DIV, R, W)
+    HANDLERS(CMP, R, N)
+    HANDLERS(AND, R, W)
+    HANDLERS(OR, R, W)
+    HANDLERS(NOT, R, W)
+    HANDLERS(TEST, R, N)
+    HANDLERS(PUSH, R, N)
+    HANDLERS(POP, N, W)
+    HANDLERS(CALL, N, N)
+    HANDLERS(IRET, N, N)
+    HANDLERS(MOV, N, W)
+    HANDLERS(SHL, R, W)
+    HANDLERS(SHR, R, W)
+
+ILLEGAL:
+    vm->intr = 1;
+    vm->ivtentry = ILLEGAL_INSTRUCTION_IVTENTRY;
+    goto next;
+
+JCC:
+    FUSED_JCC
+    goto next;
+
+FUSED_MOV_CMP_JCC:
+    f = e;
+    FUSED_MOV
+    FUSED_NEXT
+    FUSED_CMP
+    FUSED_NEXT
+    FUSED_JCC
+    goto next;
+
+FUSED_CMP_JCC:
+    f = e;
+    FUSED_CMP
+    FUSED_NEXT
+    FUSED_JCC
+    goto next;
+
+FUSED_PUSH_PUSH:
+    f = e;
+    FUSED_PUSH
+    FUSED_NEXT
+    FUSED_PUSH
+    goto next;
+
+FUSED_POP_POP:
+    f = e;
+    FUSED_POP
+    FUSED_NEXT
+    FUSED_POP
+    goto next;
+
+FUSED_POP_RET:
+    f = e;
+    FUSED_POP
+    FUSED_NEXT
+    FUSED_RET
+    goto next;
+
+FUSED_MOV_OUT:
+    f = e;
+    FUSED_MOV
+    FUSED_NEXT
+    FUSED_OUT
+    goto next;
+
+FUSED_MOV_MOV:
+    f = e;
+    FUSED_MOV
+    FUSED_NEXT
+    FUSED_MOV
+    goto next;
+
+halt:
+    ++vm->retired;
+    if (vm->intr)
+        interrupt(vm);
+}
@@ -0,0 +1,96 @@
+/* File: trace.c */
+/* Instruction trace: binary records of retired instructions in a mapped ring file. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Note: non-standard headers, available on POSIX systems */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "vm.h"
+#include "control.h"
+#include "trace_format.h"
+#include "trace.h"
+
+int init_trace(struct vm *vm)
+{
+    const char *filename = vm->options.trace_filename;
+    if (!filename)
+        return 1;
+
+    struct trace *t = calloc(1, sizeof(struct trace));
+    if (!t)
+    {
+        write_log(LOG_ERROR, "trace: out of memory");
+        return 0;
+    }
+    vm->trace = t;
+
+    t->capacity = vm->options.trace_records ? vm->options.trace_records : TRACE_DEFAULT_RECORDS;
+    uint64_t size = TRACE_RECORDS_OFFSET + t->capacity * sizeof(TraceRecord);
+    t->pc_lo = vm->options.trace_pc_lo;
+    t->pc_hi = vm->options.trace_pc_hi;
+    t->from = vm->options.trace_from;
+    t->to = vm->options.trace_to ? vm->options.trace_to : UINT64_MAX;
+
+    if (size > SIZE_MAX)
+    {
+        write_log(LOG_ERROR, "trace: %llu records don't fit in the address space",
+                  (unsigned long long) t->capacity);
+        return 0;
+    }
+    t->size = (size_t) size;
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        write_log(LOG_ERROR, "trace: failed to open file '%s'", filename);
+        return 0;
+    }
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, (off_t) t->size) == 0)
+        map = mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        write_log(LOG_ERROR, "trace: failed to map %lluB of file '%s'",
+                  (unsigned long long) t->size, filename);
+        return 0;
+    }
+    t->header = map;
+    t->ring = (TraceRecord *)((unsigned char *) map + TRACE_RECORDS_OFFSET);
+
+    memcpy(t->header->magic, TRACE_MAGIC, sizeof(t->header->magic));
+    t->header->version = TRACE_VERSION;
+    t->header->record_size = sizeof(TraceRecord);
+    t->header->capacity = t->capacity;
+    t->header->written = 0;
+
+    if (vm->options.engine != ENGINE_INTERP)
+    {
+        write_log(LOG_NORMAL, "trace: using the interp engine");
+        vm->options.engine = ENGINE_INTERP;
+    }
+    return 1;
+}
+
+void close_trace(struct vm *vm)
+{
+    struct trace *t = vm->trace;
+    if (!t)
+        return;
+    if (t->header)
+    {
+        write_log(LOG_NORMAL, "trace: %llu records written to '%s'",
+                  (unsigned long long) t->header->written, vm->options.trace_filename);
+        munmap(t->header, t->size);
+    }
+    free(t);
+    vm->trace = NULL;
+}
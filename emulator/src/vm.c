@@ -0,0 +1,79 @@
+/* File: vm.c */
+/* Emulated machine: CPU, memory and devices of one guest. */
+
+/* Note: MAP_ANONYMOUS is not part of ISO C nor of POSIX.1-2008 */
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Note: non-standard header, available on POSIX systems */
+#include <sys/mman.h>
+
+#include "log.h"
+#include "vm.h"
+#include "icache.h"
+#include "mmio.h"
+#include "sched.h"
+#include "devices.h"
+#include "block.h"
+#include "net.h"
+#include "jit.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "sampler.h"
+#include "trace.h"
+#include "replay.h"
+
+struct vm *vm_create(const struct vm_options *options)
+{
+    struct vm *vm = calloc(1, sizeof(struct vm));
+    if (!vm)
+        return NULL;
+
+    vm->options = *options;
+    vm->idle_generation = ~0u; /* no branch checked yet */
+
+    /* a mapping rather than an array, so a snapshot can be mapped over it */
+    vm->mem = mmap(NULL, MEM_SIZE + MEM_GUARD_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (vm->mem == MAP_FAILED)
+    {
+        vm->mem = NULL;
+        write_log(LOG_ERROR, "failed to map %dB of guest memory", MEM_SIZE);
+        vm_destroy(vm);
+        return NULL;
+    }
+
+    if (!init_icache(vm) || !init_mmio(vm) || !init_sched(vm) || !init_replay(vm) || !init_timer(vm)
+        || !init_output_device(vm) || !init_input_device(vm) || !init_block_device(vm)
+        || !init_net_device(vm) || !init_profile(vm) || !init_callgraph(vm) || !init_sampler(vm) || !init_trace(vm)
+        || vm->failed)
+    {
+        write_log(LOG_ERROR, "failed to create a machine");
+        vm_destroy(vm);
+        return NULL;
+    }
+
+    return vm;
+}
+
+void vm_destroy(struct vm *vm)
+{
+    close_net_device(vm);
+    close_block_device(vm);
+    close_input_device(vm);
+    close_output_device(vm);
+    close_timer(vm);
+    close_jit(vm);
+    close_profile(vm);
+    close_callgraph(vm);
+    close_sampler(vm);
+    close_trace(vm);
+    close_replay(vm);
+    close_sched(vm);
+    close_mmio(vm);
+    close_icache(vm);
+    if (vm->mem)
+        munmap(vm->mem, MEM_SIZE + MEM_GUARD_SIZE);
+    free(vm);
+}
@@ -0,0 +1,41 @@
+; gen.s - Send count numbered 64 byte packets.
+
+.data
+
+count:          .word 10000
+
+.bss
+
+packet:         .skip 64
+ring:           .skip 32                ; 8 transmit descriptors
+
+.text
+
+.global START
+START:
+                mov r0, &ring
+                mov *65424, r0          ; transmit ring
+                mov *65426, r0          ; receive ring, unused
+                mov r0, 8
+                mov *65428, r0          ; ring size
+
+                mov r1, 0               ; packet number
+                mov r2, 0               ; transmit tail
+next:           mov packet, r1
+                mov r3, r2
+                shl r3, 2
+                add r3, &ring
+                mov r0, &packet
+                mov r3[0], r0
+                mov r0, 64
+                mov r3[2], r0
+                add r2, 1
+                and r2, 7
+                mov *65432, r2          ; transmit tail, sends the packet
+                add r1, 1
+                cmp r1, count
+                jmpgt $done
+                jmpeq $done
+                jmp $next
+done:           halt
+.end
@@ -0,0 +1,23 @@
+;intr.s
+
+.data       ; interrupt vector table
+
+.word       0      ; entry 0
+.word       0      ; entry 1
+.word       0      ; entry 2
+.word       0      ; entry 3
+.word       0      ; entry 4
+.word       intr_5 ; entry 5
+.word       0      ; entry 6
+.word       0      ; entry 7
+
+.text       ; interrupt routines
+
+.global ready
+
+intr_5:     push r0
+            mov r0, 1
+            mov ready, r0
+            pop r0
+            iret
+.end
@@ -0,0 +1,79 @@
+; main.s - Echo every packet received back to its sender.
+
+.text
+
+.global ready
+.global rx_next
+.global tx_tail
+.global rx_ring
+.global tx_ring
+.global buffers
+
+.global START
+START:
+                ; hand every receive buffer to its descriptor
+                mov r1, &rx_ring
+                mov r2, &buffers
+                mov r3, 8
+init:           mov r1[0], r2
+                mov r0, 256
+                mov r1[2], r0
+                add r1, 4
+                add r2, 256
+                sub r3, 1
+                jmpgt $init
+
+                mov r0, &tx_ring
+                mov *65424, r0          ; transmit ring
+                mov r0, &rx_ring
+                mov *65426, r0          ; receive ring
+                mov r0, 8
+                mov *65428, r0          ; ring size
+                mov r0, 4
+                mov *65438, r0          ; interrupt every 4 packets
+                mov r0, 4096
+                mov *65440, r0          ; or 4096 instructions after the first
+                mov r0, 7
+                mov *65436, r0          ; receive descriptors 0 to 6 are free
+
+wait:           mov r0, ready
+                cmp r0, 0
+                jmpeq $wait
+
+                mov r0, 0
+                mov ready, r0
+next:           mov r1, rx_next
+                cmp r1, *65434          ; receive head
+                jmpeq $drained
+
+                ; send the received buffer as it is
+                mov r2, r1
+                shl r2, 2
+                add r2, &rx_ring
+                mov r3, tx_tail
+                shl r3, 2
+                add r3, &tx_ring
+                mov r4, r2[0]
+                mov r3[0], r4
+                mov r4, r2[2]
+                mov r3[2], r4
+                mov r3, tx_tail
+                add r3, 1
+                and r3, 7
+                mov tx_tail, r3
+                mov *65432, r3          ; transmit tail, sends the packet
+
+                ; and give it back to the device
+                mov r4, 256
+                mov r2[2], r4
+                mov *65436, r1          ; receive tail
+                add r1, 1
+                and r1, 7
+                mov rx_next, r1
+                jmp $next
+
+drained:        mov r0, *65442          ; status
+                and r0, 1               ; end of the packet file
+                jmpeq $wait
+                halt
+.end
@@ -0,0 +1,25 @@
+; ring.s - packet device rings and buffers
+
+.data
+
+.global ready
+ready:          .word 0                 ; set by the receive interrupt
+
+.global rx_next
+rx_next:        .word 0                 ; next received descriptor to process
+
+.global tx_tail
+tx_tail:        .word 0                 ; next transmit descriptor to fill
+
+.bss
+
+.global rx_ring
+rx_ring:        .skip 32                ; 8 descriptors: buffer address, length
+
+.global tx_ring
+tx_ring:        .skip 32
+
+.global buffers
+buffers:        .skip 2048              ; 8 buffers of 256 bytes
+
+.end
@@ -0,0 +1,17 @@
+; data.s - storage
+
+.rodata
+
+.global line
+line:           .char 84, 104, 101, 32, 113, 117, 105, 99, 107, 32, 98, 114, 111, 119, 110, 32
+                .char 102, 111, 120, 32, 106, 117, 109, 112, 115, 32, 111, 118, 101, 114, 32
+                .char 116, 104, 101, 32, 108, 97, 122, 121, 32, 100, 111, 103, 46, 13, 00
+                                                ; "The quick brown fox jumps over the lazy dog.\n"
+
+.global line_len
+line_len:       .word 45
+
+.global count
+count:          .word 10000
+
+.end
@@ -0,0 +1,20 @@
+; dma.s - Print a line count times with printn.
+
+.text
+
+.global printn
+.global line
+.global line_len
+.global count
+
+.global START
+START:
+                mov r1, count
+next:           push line_len
+                push &line
+                call printn
+                add r6, 4
+                sub r1, 1
+                jmpgt $next
+                halt
+.end
@@ -0,0 +1,18 @@
+; loop.s - Print a line count times with prints.
+
+.text
+
+.global prints
+.global line
+.global count
+
+.global START
+START:
+                mov r1, count
+next:           push &line
+                call prints
+                add r6, 2
+                sub r1, 1
+                jmpgt $next
+                halt
+.end
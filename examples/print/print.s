@@ -0,0 +1,32 @@
+; print.s - print library
+
+.text
+
+; prints(str) - print a null-terminated string, one character at a time
+.global prints
+prints:
+                push r1
+                push r2
+                mov r1, r6[6]
+putchar:        mov r2, r1[0]
+                and r2, 255
+                jmpeq $return
+                mov *65534, r2
+                add r1, 1
+                jmp $putchar
+return:         pop r2
+                pop r1
+                ret
+
+; printn(buf, len) - print len characters of buf with a single output buffer command
+.global printn
+printn:
+                push r1
+                mov r1, r6[4]
+                mov *65528, r1          ; buffer address register
+                mov r1, r6[6]
+                mov *65530, r1          ; buffer length register, starts the output
+                pop r1
+                ret
+
+.end
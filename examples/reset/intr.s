@@ -0,0 +1,21 @@
+;intr.s
+
+.data       ; interrupt vector table
+
+.word       intr_0 ; entry 0
+.word       0      ; entry 1
+.word       0      ; entry 2
+.word       0      ; entry 3
+.word       0      ; entry 4
+.word       0      ; entry 5
+.word       0      ; entry 6
+.word       0      ; entry 7
+
+.text       ; interrupt routines
+
+; The reset interrupt is taken after the first instruction of START,
+; so its r2 is the one printed.
+intr_0:     mov r2, 7
+            iret
+
+.end
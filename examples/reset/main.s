@@ -0,0 +1,13 @@
+; main.s
+
+.text
+
+.global START
+START:
+        mov r2, 1
+        mov r3, r2
+        add r3, 48
+        mov *65534, r3
+        halt
+
+.end
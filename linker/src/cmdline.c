@@ -6,7 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-/* Note: non-standard header, available on POSIX systems */
+/* Note: non-standard header, available on GNU systems */
 #include <getopt.h>
 
 #include "cmdline.h"
@@ -17,13 +17,27 @@ extern char *log_filename;
 extern char *const *object_filenames;
 
 extern int ignore_predefined_origin;
+extern int flat_output;
+extern int flat_symbols;
+
+/* Values getopt_long returns for the long options without a short form. */
+enum {
+    OPT_FLAT = 256,
+    OPT_SYMBOLS,
+};
 
 void parse_cmdline(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        { "flat",    no_argument, NULL, OPT_FLAT },
+        { "symbols", no_argument, NULL, OPT_SYMBOLS },
+        { "help",    no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
     int c;
 
     opterr = 0;
 
-    while ((c = getopt(argc, argv, "o:t:l:h")) != -1)
+    while ((c = getopt_long(argc, argv, "o:t:l:ih", long_options, NULL)) != -1)
     {
         switch (c)
         {
@@ -39,14 +53,22 @@ void parse_cmdline(int argc, char *argv[]) {
         case 'i':
             ignore_predefined_origin = 1;
             break;
+        case OPT_FLAT:
+            flat_output = 1;
+            break;
+        case OPT_SYMBOLS:
+            flat_symbols = 1;
+            break;
         case 'h':
             printf("ETF - System software - Linker v1.0\n"
                     "Usage:\n\t%s [-o output_file] [-t output_text_file] [-l log_file] "
-                    "[-i] [-h] object_file...\n\n", argv[0]);
+                    "[-i] [--flat [--symbols]] [-h] object_file...\n\n", argv[0]);
             printf("\t-o file\t-- specify executable filename (default: a.out)\n"
                    "\t-t file\t-- specify text output filename\n"
                    "\t-l file\t-- specify log filename\n"
                    "\t-i     \t-- ignore section load addresses predefined in input files\n"
+                   "\t--flat \t-- write a flat executable: header and 64 KiB memory image\n"
+                   "\t--symbols\t-- include global symbols in a flat executable\n"
                    "\t-h     \t-- print this message and exit\n");
             exit(EXIT_SUCCESS);
             break;
@@ -55,6 +77,10 @@ void parse_cmdline(int argc, char *argv[]) {
             {
                 fprintf(stderr, "Option -%c requires an argument\n", optopt);
             }
+            else if (optopt == 0)
+            {
+                fprintf(stderr, "Unknown option '%s'\n", argv[optind - 1]);
+            }
             else if (isprint(optopt))
             {
                 fprintf(stderr, "Unknown option '-%c'\n", optopt);
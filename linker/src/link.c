@@ -264,6 +264,90 @@ void check_overlap(void)
     }
 }
 
+static int compare_flat_symbols(const void *a, const void *b)
+{
+    const FlatSymbol *x = a;
+    const FlatSymbol *y = b;
+    if (x->sym_val != y->sym_val)
+        return x->sym_val < y->sym_val ? -1 : 1;
+    return strcmp(x->sym_name, y->sym_name);
+}
+
+/* Function write_flat writes the linked program to a binary file fp as a flat executable,
+ * and optionally a description of it to a text file txt_fp. */
+void write_flat(FILE *fp, FILE *txt_fp)
+{
+    extern int flat_symbols;
+
+    FlatHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FLAT_MAGIC, sizeof(hdr.magic));
+    hdr.version = FLAT_VERSION;
+    hdr.entry = find_symbol(&symtab, "START")->sym_val;
+
+    ProgramHeaderNode *prog_hdr_node;
+    for (prog_hdr_node = prog_hdrtab.first; prog_hdr_node; prog_hdr_node = prog_hdr_node->next)
+    {
+        SegmentRecord segment = prog_hdr_node->record;
+        if (segment.size == 0)
+            continue;
+        unsigned page;
+        unsigned last = (segment.load_addr + segment.size - 1) / FLAT_PAGE_SIZE;
+        for (page = segment.load_addr / FLAT_PAGE_SIZE; page <= last; ++page)
+            hdr.segment_map[page / 8] |= 1 << (page % 8);
+    }
+
+    /* stripped symbol section: defined global symbols only, sorted by value */
+    FlatSymbol *syms = NULL;
+    if (flat_symbols)
+    {
+        syms = (FlatSymbol *) calloc(symtab.sym_cnt ? symtab.sym_cnt : 1, sizeof(FlatSymbol));
+        if (!syms)
+            memory_alloc_error("linker", "FlatSymbol", symtab.sym_cnt * sizeof(FlatSymbol));
+
+        SymbolTableNode *st_node;
+        for (st_node = symtab.first; st_node; st_node = st_node->next)
+        {
+            SymbolTableEntry entry = st_node->entry;
+            if (entry.sym_type != TYPE_SYMBOL || entry.sym_ndx == 0)
+                continue;
+            syms[hdr.sym_cnt].sym_val = entry.sym_val;
+            strncpy(syms[hdr.sym_cnt].sym_name, entry.sym_name, SYMBOL_MAXLEN);
+            ++hdr.sym_cnt;
+        }
+        qsort(syms, hdr.sym_cnt, sizeof(FlatSymbol), compare_flat_symbols);
+        if (hdr.sym_cnt > 0)
+            hdr.symtab_offset = FLAT_IMAGE_OFFSET + FLAT_IMAGE_SIZE;
+    }
+
+    static const unsigned char padding[FLAT_IMAGE_OFFSET];
+    fwrite(&hdr, sizeof(FlatHeader), 1, fp);
+    fwrite(padding, FLAT_IMAGE_OFFSET - sizeof(FlatHeader), 1, fp);
+    fwrite(obj_code, FLAT_IMAGE_SIZE, 1, fp);
+    if (hdr.sym_cnt > 0)
+        fwrite(syms, sizeof(FlatSymbol), hdr.sym_cnt, fp);
+
+    if (txt_fp)
+    {
+        fprintf(txt_fp, "Flat executable, entry point %#x\n\n", hdr.entry);
+        fprintf(txt_fp, "Segments:\n");
+        for (prog_hdr_node = prog_hdrtab.first; prog_hdr_node; prog_hdr_node = prog_hdr_node->next)
+        {
+            fprintf(txt_fp, "%#8x %#8x %s\n", prog_hdr_node->record.load_addr, prog_hdr_node->record.size,
+                    find_section(&symtab, prog_hdr_node->record.idx)->sym_name);
+        }
+        if (hdr.sym_cnt > 0)
+        {
+            fprintf(txt_fp, "\nSymbols:\n");
+            uint32_t i;
+            for (i = 0; i < hdr.sym_cnt; ++i)
+                fprintf(txt_fp, "%#8x %s\n", syms[i].sym_val, syms[i].sym_name);
+        }
+    }
+
+    free(syms);
+}
+
 int link_files(FILE **obj_fp, int nfiles, const char *out_filename, const char *out_txt_filename)
 {
     if (!obj_fp || nfiles < 0 || !out_filename) return 1; /* error */
@@ -290,6 +374,16 @@ int link_files(FILE **obj_fp, int nfiles, const char *out_filename, const char *
         exit(EXIT_FAILURE);
     }
 
+    extern int flat_output;
+    if (flat_output)
+    {
+        write_flat(out_fp, out_txt_fp);
+        fclose(out_fp);
+        if (out_txt_fp)
+            fclose(out_txt_fp);
+        return 0;
+    }
+
     /* write symbol table */
     write_symtab(&symtab, out_fp, out_txt_fp);
 
@@ -18,6 +18,8 @@ char *const *object_filenames = NULL;
 FILE **obj_fp = NULL;
 
 int ignore_predefined_origin = 0;
+int flat_output = 0;
+int flat_symbols = 0;
 
 int main(int argc, char *argv[])
 {